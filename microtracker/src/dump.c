@@ -8,6 +8,14 @@
 #include "wavwriter.h"
 #include "f2s.h"
 
+static void write_block(FILE* f, float const* left, float const* right, int length) {
+  short out[512];
+  float_to_short_stereo(left,right,out,length);
+  for(int i=0;i<length*2;i++) {
+    fputint16(out[i],f);
+  }
+}
+
 int main(int argc, char** argv) {
   const char* infile = argc >= 2 ? argv[1] : "untitled.song";
   const char* outfile = argc >= 3 ? argv[2] : "dump.wav";
@@ -15,9 +23,13 @@ int main(int argc, char** argv) {
   struct player player;
   struct synthdesc const* synthdesc = finddesc("simplesynth");
   struct synthdesc const* effectdesc = finddesc("reverb2");
+  if (!synthdesc) {
+    fprintf(stderr,"Couldn't load synth plugin dll\n");
+    return 1;
+  }
   song_init(&song);
   song_load(&song,infile);
-  if (!player_init(&player,&song,synthdesc,effectdesc,SAMPLERATE)) {
+  if (!player_init(&player,&song,synthdesc,effectdesc,SAMPLERATE,0)) {
     player_play(&player);
     FILE* f = wavwriter_begin(outfile,SAMPLERATE);
     if (!f) {
@@ -26,15 +38,22 @@ int main(int argc, char** argv) {
     else {
       float left[256];
       float right[256];
-      short out[512];
 
+      // drop the first latency samples, so that the file lines up with
+      // the song grid, and make up for them after the end
+      int skip = player_latency(&player);
       do {
         int length = player_generate_some_audio(&player,left,right,256);
-        float_to_short_stereo(left,right,out,length);
-        for(int i=0;i<length*2;i++) {
-          fputint16(out[i],f);
-        }
+        int skipped = skip < length ? skip : length;
+        skip -= skipped;
+        write_block(f,left+skipped,right+skipped,length-skipped);
       } while(!player_is_at_beginning_of_song(&player));
+      player_stop(&player);
+      for(int remaining = player_latency(&player); remaining > 0;) {
+        int length = player_generate_some_audio(&player,left,right,remaining < 256 ? remaining : 256);
+        write_block(f,left,right,length);
+        remaining -= length;
+      }
       wavwriter_end(f);
     }
     player_finalize(&player);
@@ -1,15 +1,18 @@
 #include <ncurses.h>
 #include <memory.h>
+#include <malloc.h>
 #include "editor.h"
 #include "player.h"
+#include "saver.h"
 #include "util.h"
 
-void editor_init(struct editor* editor,const char* filename,struct song* song,struct player* player) {
+void editor_init(struct editor* editor,const char* filename,struct song* song,struct player* player,struct saver* saver) {
   memset(editor,0,sizeof(*editor));
   songcursor_init(&editor->cursor);
   editor->filename = filename;
   editor->song = song;
   editor->player = player;
+  editor->saver = saver;
 
   initscr();
   keypad(stdscr,TRUE);
@@ -20,15 +23,46 @@ void editor_init(struct editor* editor,const char* filename,struct song* song,st
   editor->tuning_mode = MODE_JI;
 }
 
+static void editor_redraw_params(struct editor* editor) {
+  struct player* player = editor->player;
+  int num_params = player_num_synth_params(player);
+  wmove(editor->win,0,0);
+  wprintw(editor->win,"synth parameters (F4 to close)");
+  if (num_params == 0) {
+    wmove(editor->win,2,0);
+    wprintw(editor->win,"none");
+  }
+  for(int i=0;i<num_params;i++) {
+    struct playerparam desc;
+    if (player_synth_param_desc(player,i,&desc))
+      break;
+    char buffer[80];
+    snprintf(buffer,80,"%c %-20s %10.4g %s",i == editor->param_cursor ? '>' : ' ',
+             desc.name,player_get_synth_param(player,i),desc.unit);
+    wmove(editor->win,2+i,0);
+    wprintw(editor->win,buffer);
+  }
+  wmove(editor->win,2+editor->param_cursor,0);
+  wrefresh(editor->win);
+}
+
 void editor_redraw(struct editor* editor) {
   werase(editor->win);
+  if (editor->show_params) {
+    editor_redraw_params(editor);
+    return;
+  }
 
   int num_cols,num_rows;
   getmaxyx(editor->win,num_rows,num_cols);
   int middle_line = num_rows / 2;
   struct song* song = editor->song;
   int order_pos = songcursor_order_pos(&editor->cursor);
-  for(int i = 0; song->order[i] != END_OF_ORDER; i++) {
+  int order_length = song_order_length(song);
+  int first_visible = order_pos - middle_line;
+  if (first_visible < 0)
+    first_visible = 0;
+  for(int i = first_visible; i < order_length && middle_line + i - order_pos < num_rows; i++) {
     int screen_line = middle_line + i - order_pos;
     wmove(editor->win,screen_line,0);
     char buf[3];
@@ -48,6 +82,9 @@ void editor_redraw(struct editor* editor) {
     for(int t = 0; t < PAT_TRACKS; t++) {
       wmove(editor->win,screen_line,4 + t * 8);
       struct event event = song->patterns[pat][l][t];
+      int in_block = editor_is_in_block(editor,l,t);
+      if (in_block)
+        wattron(editor->win,A_REVERSE);
       switch(event.cmd) {
       case CMD_NOP: wprintw(editor->win,"..."); break;
       case CMD_NOTE_OFF: wprintw(editor->win,"off"); break;
@@ -72,17 +109,27 @@ void editor_redraw(struct editor* editor) {
           wprintw(editor->win,buffer);
 	  break;
 	}
+      case CMD_SCALE_NOTE_ON:
+	{
+	  char buffer[9];
+	  snprintf(buffer,9,"%i;%i",event.octave,event.degree);
+          wprintw(editor->win,buffer);
+	  break;
+	}
       default: wprintw(editor->win,"???"); break;
       }
+      if (in_block)
+        wattroff(editor->win,A_REVERSE);
     }
   }
   wmove(editor->win,0,4 + 4 * 8);
 
   struct player* player = editor->player;
   struct songcursor const* player_cursor = &player->cursor;
-  char buffer[20];
-  snprintf(buffer,20,"%02x %02x %02x",songcursor_order_pos(player_cursor),
-	   songcursor_pattern(player_cursor,song),songcursor_pattern_line(player_cursor));
+  char buffer[32];
+  snprintf(buffer,32,"%02x %02x %02x %iedo",songcursor_order_pos(player_cursor),
+	   songcursor_pattern(player_cursor,song),songcursor_pattern_line(player_cursor),
+	   song->octave_divisions);
   wprintw(editor->win,buffer);
 
 
@@ -108,9 +155,6 @@ void editor_move_pat_line(struct editor* editor,int delta) {
   songcursor_move_pat_line(&editor->cursor,editor->song,delta);
 }
 
-static int diatonic_table_53_edo[7] = { 0, 9, 17, 22, 31, 39, 48 };
-static int diatonic_table_31_edo[7] = { 0, 5, 10, 13, 18, 23, 28 };
-
 void editor_enter_note_on(struct editor* editor,int octave,int diatonic) {
   struct event* event = editor_get_current_event_ptr(editor);
   player_begin_song_edit(editor->player);
@@ -118,12 +162,17 @@ void editor_enter_note_on(struct editor* editor,int octave,int diatonic) {
   case MODE_EDO:
     event->cmd = CMD_NOTE_ON;
     event->octave = octave;
-    event->degree = diatonic_table_53_edo[diatonic];
+    event->degree = editor->song->tuning.diatonic[diatonic];
     break;
   case MODE_31_EDO:
     event->cmd = CMD_31_EDO_NOTE_ON;
     event->octave = octave;
-    event->degree = diatonic_table_31_edo[diatonic];
+    event->degree = editor->song->tuning_31_edo.diatonic[diatonic];
+    break;
+  case MODE_SCALE:
+    event->cmd = CMD_SCALE_NOTE_ON;
+    event->octave = octave;
+    event->degree = editor->song->tuning_scale.diatonic[diatonic];
     break;
   }
   player_end_song_edit(editor->player);
@@ -178,32 +227,163 @@ void editor_increment_order(struct editor* editor,int delta) {
   player_end_song_edit(editor->player);
 }
 
-void editor_transpose(struct editor* editor,int delta) {
-  struct event* event = editor_get_current_event_ptr(editor);
-  int degree = event->degree + delta;
-  int octave = event->octave;
-  int octave_divisions;
+static int event_octave_divisions(struct song const* song, struct event const* event) {
   switch (event->cmd) {
-  case CMD_NOTE_ON: octave_divisions = 53; break;
-  case CMD_31_EDO_NOTE_ON: octave_divisions = 31; break;
-  default:
-    return;
+  case CMD_NOTE_ON: return song->tuning.octave_divisions;
+  case CMD_31_EDO_NOTE_ON: return song->tuning_31_edo.octave_divisions;
+  case CMD_SCALE_NOTE_ON: return song->tuning_scale.octave_divisions;
+  default: return 0;
   }
-  while (degree < 0) {
-    degree += octave_divisions;
+}
+
+static void event_set_pitch(struct song const* song, struct event* event, int pitch) {
+  int octave_divisions = event_octave_divisions(song,event);
+  int octave = 0;
+  while (pitch < 0) {
+    pitch += octave_divisions;
     octave -= 1;
   }
-  while (degree >= octave_divisions) {
-    degree -= octave_divisions;
+  while (pitch >= octave_divisions) {
+    pitch -= octave_divisions;
     octave += 1;
   }
   if (octave < 0)
     octave = 0;
   if (octave > 7)
     octave = 7;
-  player_begin_song_edit(editor->player);
   event->octave = octave;
-  event->degree = degree;
+  event->degree = pitch;
+}
+
+// the block spans from the block mark to the cursor's line and track, in
+// the pattern the mark was set in, or is just the cursor position in the
+// current pattern when nothing is marked. returns the block's pattern.
+static int editor_get_block(struct editor* editor,int* first_line,int* last_line,int* first_track,int* last_track) {
+  int line = songcursor_pattern_line(&editor->cursor);
+  int track = editor->pat_track;
+  int mark_line = editor->block_marked ? editor->block_line : line;
+  int mark_track = editor->block_marked ? editor->block_track : track;
+  *first_line = line < mark_line ? line : mark_line;
+  *last_line = line < mark_line ? mark_line : line;
+  *first_track = track < mark_track ? track : mark_track;
+  *last_track = track < mark_track ? mark_track : track;
+  return editor->block_marked ? editor->block_pattern : editor_get_current_pattern(editor);
+}
+
+int editor_is_in_block(struct editor* editor,int line,int track) {
+  if (!editor->block_marked)
+    return 0;
+  int first_line,last_line,first_track,last_track;
+  int pat = editor_get_block(editor,&first_line,&last_line,&first_track,&last_track);
+  if (pat != editor_get_current_pattern(editor))
+    return 0;
+  return first_line <= line && line <= last_line && first_track <= track && track <= last_track;
+}
+
+void editor_toggle_block_mark(struct editor* editor) {
+  editor->block_marked = !editor->block_marked;
+  editor->block_pattern = editor_get_current_pattern(editor);
+  editor->block_line = songcursor_pattern_line(&editor->cursor);
+  editor->block_track = editor->pat_track;
+}
+
+void editor_transpose(struct editor* editor,int delta) {
+  int first_line,last_line,first_track,last_track;
+  int pat = editor_get_block(editor,&first_line,&last_line,&first_track,&last_track);
+  struct songtransaction t;
+  songtransaction_init(&t);
+  for(int l = first_line; l <= last_line; l++) {
+    for(int tr = first_track; tr <= last_track; tr++) {
+      struct event event = editor->song->patterns[pat][l][tr];
+      int octave_divisions = event_octave_divisions(editor->song,&event);
+      if (!octave_divisions)
+        continue;
+      event_set_pitch(editor->song, &event, event.octave * octave_divisions + event.degree + delta);
+      songtransaction_set_event(&t,pat,l,tr,event);
+    }
+  }
+  player_apply_transaction(editor->player,&t);
+}
+
+void editor_copy_block(struct editor* editor) {
+  int first_line,last_line,first_track,last_track;
+  int pat = editor_get_block(editor,&first_line,&last_line,&first_track,&last_track);
+  editor->clipboard_lines = last_line - first_line + 1;
+  editor->clipboard_tracks = last_track - first_track + 1;
+  for(int l = 0; l < editor->clipboard_lines; l++) {
+    for(int tr = 0; tr < editor->clipboard_tracks; tr++) {
+      editor->clipboard[l][tr] = editor->song->patterns[pat][first_line + l][first_track + tr];
+    }
+  }
+}
+
+void editor_paste_block(struct editor* editor) {
+  int first_line = songcursor_pattern_line(&editor->cursor);
+  int first_track = editor->pat_track;
+  int pat = editor_get_current_pattern(editor);
+  struct songtransaction t;
+  songtransaction_init(&t);
+  for(int l = 0; l < editor->clipboard_lines && first_line + l < PAT_LINES; l++) {
+    for(int tr = 0; tr < editor->clipboard_tracks && first_track + tr < PAT_TRACKS; tr++) {
+      songtransaction_set_event(&t,pat,first_line + l,first_track + tr,editor->clipboard[l][tr]);
+    }
+  }
+  player_apply_transaction(editor->player,&t);
+}
+
+void editor_clear_block(struct editor* editor) {
+  int first_line,last_line,first_track,last_track;
+  int pat = editor_get_block(editor,&first_line,&last_line,&first_track,&last_track);
+  struct event nop = { .cmd = CMD_NOP };
+  struct songtransaction t;
+  songtransaction_init(&t);
+  for(int l = first_line; l <= last_line; l++) {
+    for(int tr = first_track; tr <= last_track; tr++) {
+      songtransaction_set_event(&t,pat,l,tr,nop);
+    }
+  }
+  player_apply_transaction(editor->player,&t);
+}
+
+// fills each track of the block with notes gliding in equal steps from
+// the note on the first line of the block to the note on the last line
+void editor_interpolate_block(struct editor* editor) {
+  int first_line,last_line,first_track,last_track;
+  int pat = editor_get_block(editor,&first_line,&last_line,&first_track,&last_track);
+  if (last_line - first_line < 2)
+    return;
+  struct songtransaction t;
+  songtransaction_init(&t);
+  for(int tr = first_track; tr <= last_track; tr++) {
+    struct event first = editor->song->patterns[pat][first_line][tr];
+    struct event last = editor->song->patterns[pat][last_line][tr];
+    int octave_divisions = event_octave_divisions(editor->song,&first);
+    if (!octave_divisions || first.cmd != last.cmd)
+      continue;
+    int first_pitch = first.octave * octave_divisions + first.degree;
+    int last_pitch = last.octave * octave_divisions + last.degree;
+    int span = last_line - first_line;
+    for(int l = first_line + 1; l < last_line; l++) {
+      struct event event = first;
+      int step = (last_pitch - first_pitch) * (l - first_line);
+      // round to nearest, also for negative steps
+      int pitch = first_pitch + (step >= 0 ? step + span / 2 : step - span / 2) / span;
+      event_set_pitch(editor->song,&event,pitch);
+      songtransaction_set_event(&t,pat,l,tr,event);
+    }
+  }
+  player_apply_transaction(editor->player,&t);
+}
+
+void editor_increment_octave_divisions(struct editor* editor,int delta) {
+  int octave_divisions = editor->song->octave_divisions + delta;
+  if (octave_divisions < 1 || octave_divisions > 255)
+    return;
+  // building the table takes a while, so do it before taking the lock
+  struct tuning tuning;
+  tuning_init_edo(&tuning,octave_divisions);
+  player_begin_song_edit(editor->player);
+  song_set_tuning(editor->song,&tuning);
   player_end_song_edit(editor->player);
 }
 
@@ -213,9 +393,69 @@ void editor_uniquify_pattern(struct editor* editor) {
   player_end_song_edit(editor->player);
 }
 
+void editor_reload(struct editor* editor) {
+  // load into a scratch song first so the player lock is never held
+  // while waiting for the disk
+  struct song* loaded = malloc(sizeof(struct song));
+  if (!loaded)
+    return;
+  song_init(loaded);
+  if (!song_load(loaded,editor->filename)) {
+    player_stop(editor->player);
+    player_begin_song_edit(editor->player);
+    memcpy(editor->song,loaded,sizeof(struct song));
+    player_end_song_edit(editor->player);
+    saver_mark_clean(editor->saver);
+    songcursor_normalize(&editor->cursor,editor->song);
+  }
+  song_finalize(loaded);
+  free(loaded);
+}
+
+// moves the selected parameter by steps hundredths of its range, or by
+// steps values for enums
+void editor_adjust_param(struct editor* editor,int steps) {
+  struct player* player = editor->player;
+  struct playerparam desc;
+  if (player_synth_param_desc(player,editor->param_cursor,&desc))
+    return;
+  float value = player_get_synth_param(player,editor->param_cursor);
+  value += desc.isenum ? steps : steps * (desc.max - desc.min) * 0.01;
+  if (value < desc.min)
+    value = desc.min;
+  if (value > desc.max)
+    value = desc.max;
+  player_set_synth_param(player,editor->param_cursor,value);
+}
+
+// returns 1 if the key was used by the parameter view
+static int editor_handle_param_key(struct editor* editor,int ch) {
+  int num_params = player_num_synth_params(editor->player);
+  switch(ch) {
+  case KEY_UP:
+    if (num_params > 0)
+      editor->param_cursor = util_wrap(editor->param_cursor - 1,num_params);
+    return 1;
+  case KEY_DOWN:
+    if (num_params > 0)
+      editor->param_cursor = util_wrap(editor->param_cursor + 1,num_params);
+    return 1;
+  case KEY_LEFT: editor_adjust_param(editor,-1); return 1;
+  case KEY_RIGHT: editor_adjust_param(editor,1); return 1;
+  case KEY_NPAGE: editor_adjust_param(editor,-10); return 1;
+  case KEY_PPAGE: editor_adjust_param(editor,10); return 1;
+  case 27: editor->show_params = 0; return 1;
+  }
+  // function keys keep working, everything else would edit the hidden pattern
+  return !(ch >= KEY_F(1) && ch <= KEY_F(12));
+}
+
 static int editor_handle_key(struct editor* editor) {
   int ch = getch();
 
+  if (editor->show_params && editor_handle_param_key(editor,ch))
+    return 0;
+
   switch(editor->tuning_mode) {
   case MODE_JI: 
     switch(ch) {
@@ -239,6 +479,7 @@ static int editor_handle_key(struct editor* editor) {
     break;
   case MODE_EDO:
   case MODE_31_EDO:
+  case MODE_SCALE:
     switch(ch) {
     case '1': editor_enter_note_on(editor,6,0); return 0;
     case '2': editor_enter_note_on(editor,6,1); return 0;
@@ -300,17 +541,28 @@ static int editor_handle_key(struct editor* editor) {
   case '"': editor_uniquify_pattern(editor); break;
   case '8': editor_transpose(editor,-1); break;
   case '9': editor_transpose(editor,1); break;
+  case 'B': editor_toggle_block_mark(editor); break;
+  case 'C': editor_copy_block(editor); break;
+  case 'V': editor_paste_block(editor); break;
+  case 'X': editor_clear_block(editor); break;
+  case 'I': editor_interpolate_block(editor); break;
   case '#': editor->tuning_mode = MODE_EDO; break;
   case '%': editor->tuning_mode = MODE_JI; break;
   case '$': editor->tuning_mode = MODE_31_EDO; break;
+  case '&': editor->tuning_mode = MODE_SCALE; break;
+  case '(': editor_increment_octave_divisions(editor,-1); break;
+  case ')': editor_increment_octave_divisions(editor,1); break;
   default:
     if (ch == KEY_F(2)) {
-      song_save(editor->song,editor->filename);
+      saver_request_save(editor->saver);
       break;
     }
     if (ch == KEY_F(3)) {
-      player_stop(editor->player);
-      song_load(editor->song,editor->filename);
+      editor_reload(editor);
+      break;
+    }
+    if (ch == KEY_F(4)) {
+      editor->show_params = !editor->show_params;
       break;
     }
     if (ch == KEY_F(5)) {
@@ -5,20 +5,31 @@
 #define MODE_EDO 0
 #define MODE_JI 1
 #define MODE_31_EDO 2
+#define MODE_SCALE 3
 
 struct editor {
   const char* filename;
   struct song* song;
   struct player* player;
+  struct saver* saver;
   WINDOW* win;
   struct songcursor cursor;
   short pat_track;
   int numer;
   int denom;
   int tuning_mode;
+  char block_marked;
+  short block_pattern; // where the block mark was set
+  short block_line;
+  short block_track;
+  short clipboard_lines;
+  short clipboard_tracks;
+  struct event clipboard[PAT_LINES][PAT_TRACKS];
+  char show_params; // the synth parameter view replaces the pattern
+  int param_cursor;
 };
 
-void editor_init(struct editor* editor,const char* filename,struct song* song,struct player* player);
+void editor_init(struct editor* editor,const char* filename,struct song* song,struct player* player,struct saver* saver);
 void editor_run(struct editor* editor);
 void editor_finalize(struct editor* editor);
 
@@ -35,6 +46,15 @@ void editor_insert_order(struct editor* editor);
 void editor_delete_order(struct editor* editor);
 void editor_increment_order(struct editor* editor,int delta);
 void editor_transpose(struct editor* editor,int delta);
+void editor_toggle_block_mark(struct editor* editor);
+int editor_is_in_block(struct editor* editor,int line,int track);
+void editor_copy_block(struct editor* editor);
+void editor_paste_block(struct editor* editor);
+void editor_clear_block(struct editor* editor);
+void editor_interpolate_block(struct editor* editor);
+void editor_increment_octave_divisions(struct editor* editor,int delta);
 void editor_uniquify_pattern(struct editor* editor);
 void editor_grab_note_degree(struct editor* editor);
+void editor_reload(struct editor* editor);
+void editor_adjust_param(struct editor* editor,int steps);
 
@@ -4,6 +4,7 @@ struct event {
 #define CMD_NOTE_ON 2
 #define CMD_JI_NOTE_ON 3
 #define CMD_31_EDO_NOTE_ON 4
+#define CMD_SCALE_NOTE_ON 5
   uint8_t cmd;
   uint8_t octave;
   uint8_t degree;
@@ -23,6 +23,19 @@ static int jack_process_callback(jack_nframes_t nframes, void* arg)
   return 0;
 }
 
+// the signal starts in the player, so the player's latency is capture
+// latency on the output ports
+static void jack_latency_callback(jack_latency_callback_mode_t mode, void* arg)
+{
+  struct audio_io* audio_io = (struct audio_io*)arg;
+  if (mode != JackCaptureLatency || audio_io->player == NULL)
+    return;
+  jack_nframes_t latency = player_latency(audio_io->player);
+  jack_latency_range_t range = { latency, latency };
+  jack_port_set_latency_range(audio_io->jack_port_left_out, JackCaptureLatency, &range);
+  jack_port_set_latency_range(audio_io->jack_port_right_out, JackCaptureLatency, &range);
+}
+
 void audio_io_finalize(struct audio_io* audio_io);
 
 int audio_io_init(struct audio_io* audio_io, struct player* player, int device) {
@@ -42,6 +55,13 @@ int audio_io_init(struct audio_io* audio_io, struct player* player, int device)
     goto error;
   }
 
+  if (jack_set_latency_callback(audio_io->jack_client,
+				jack_latency_callback,
+				audio_io)
+      != 0) {
+    goto error;
+  }
+
   audio_io->jack_port_left_out =
     jack_port_register(audio_io->jack_client,
 		       "left out",
@@ -72,8 +92,23 @@ int audio_io_get_sample_rate(struct audio_io* audio_io) {
   return jack_get_sample_rate(audio_io->jack_client);
 }
 
+// the priority of jack's realtime process thread, 0 if it isn't realtime
+int audio_io_get_rt_priority(struct audio_io* audio_io) {
+  if (!jack_is_realtime(audio_io->jack_client))
+    return 0;
+  int priority = jack_client_real_time_priority(audio_io->jack_client);
+  return priority > 0 ? priority : 0;
+}
+
 void audio_io_set_player(struct audio_io* audio_io, struct player* player) {
   audio_io->player = player;
+  jack_recompute_total_latencies(audio_io->jack_client);
+}
+
+// has jack ask for the latency again, not from the process callback
+void audio_io_latency_changed(void* arg) {
+  struct audio_io* audio_io = (struct audio_io*)arg;
+  jack_recompute_total_latencies(audio_io->jack_client);
 }
 
 void audio_io_finalize(struct audio_io* audio_io) {
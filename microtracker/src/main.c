@@ -8,12 +8,16 @@
 //#include "audio_io.h"
 #include "jack_audio_io.h"
 #include "editor.h"
+#include "saver.h"
+#include "reloader.h"
 
 struct options {
   int output_device;
   const char* filename;
   const char* synth;
   const char* effect;
+  int autosave_interval;
+  int reload; // swap in plugins when they are rebuilt
 };
 
 int parse_options(int argc, char** argv, struct options* o) {
@@ -21,12 +25,16 @@ int parse_options(int argc, char** argv, struct options* o) {
   o->filename = "untitled.song";
   o->synth = "simplesynth";
   o->effect = NULL;
+  o->autosave_interval = 30;
+  o->reload = 0;
   while(1) {
-    switch(getopt(argc,argv,"hO:s:e:")) {
+    switch(getopt(argc,argv,"hO:s:e:a:r")) {
     case 'h':
       printf("-O <output device>\n");
       printf("-s <synth>\n");
       printf("-e <effect>\n");
+      printf("-a <autosave interval in seconds, 0 = off>\n");
+      printf("-r reload the synth and effect when they are rebuilt\n");
       printf("<song filename>\n");
       exit(0);      
       break;
@@ -39,6 +47,12 @@ int parse_options(int argc, char** argv, struct options* o) {
     case 'e':
       o->effect = optarg;
       break;
+    case 'a':
+      o->autosave_interval = atoi(optarg);
+      break;
+    case 'r':
+      o->reload = 1;
+      break;
     case -1:
       if(optind < argc)
 	o->filename = argv[optind];
@@ -57,17 +71,33 @@ int run(struct options const* options) {
   struct player player;
   struct audio_io audio_io;
   struct editor editor;
+  static struct saver saver; // holds a whole song, too big for the stack
+  struct reloader reloader;
   struct synthdesc const* synthdesc = finddesc(options->synth);
   struct synthdesc const* effectdesc = options->effect == NULL ? NULL : finddesc(options->effect);
+  if (!synthdesc) {
+    fprintf(stderr,"Couldn't load synth plugin dll\n");
+    return 1;
+  }
   song_init(&song);
   song_load(&song,options->filename);
   if (!(error_code = audio_io_init(&audio_io,&player,options->output_device))) {
     int sample_rate = audio_io_get_sample_rate(&audio_io);
-    if (!(error_code = player_init(&player,&song,synthdesc,effectdesc, sample_rate))) {
+    // the reloader instantiates the plugins while the editor starts
+    if (!(error_code = player_init(&player,&song,NULL,NULL, sample_rate,
+                                   audio_io_get_rt_priority(&audio_io)))) {
       audio_io_set_player(&audio_io, &player);
-      editor_init(&editor,options->filename,&song,&player);
-      editor_run(&editor);
-      editor_finalize(&editor);
+      if (!(error_code = saver_init(&saver,&player,options->filename,options->autosave_interval))) {
+        if (!(error_code = reloader_init(&reloader,&player,options->synth,synthdesc,
+                                         options->effect,effectdesc,options->reload,
+                                         audio_io_latency_changed,&audio_io))) {
+          editor_init(&editor,options->filename,&song,&player,&saver);
+          editor_run(&editor);
+          editor_finalize(&editor);
+          reloader_finalize(&reloader);
+        }
+        saver_finalize(&saver);
+      }
       audio_io_finalize(&audio_io);
     }
     player_finalize(&player);
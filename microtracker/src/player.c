@@ -1,10 +1,56 @@
 #include "player.h"
+#include "util.h"
 #include <malloc.h>
 #include <stdio.h>
 #include <math.h>
 #include <memory.h>
 
-int player_init(struct player* player, struct song* song, struct synthdesc const* synthdesc, struct synthdesc const* effectdesc, int samplerate) {
+// effect_tail and latency follow from the current plugins
+static void player_update_plugin_info(struct player* player) {
+  player->effect_tail = -1;
+  if (player->effectdesc && player->effectdesc->tail) {
+    player->effect_tail = (int)(player->effectdesc->tail(player->effectstate) * player->samplerate + 0.5);
+  }
+  player->effect_silent_input = 0;
+
+  int latency = 0;
+  if (player->synthdesc && player->synthdesc->latency)
+    latency += player->synthdesc->latency(player->synthstate);
+  if (player->effectdesc && player->effectdesc->latency)
+    latency += player->effectdesc->latency(player->effectstate);
+  if (latency != player->latency) {
+    __atomic_store_n(&player->latency, latency, __ATOMIC_RELAXED);
+    __atomic_store_n(&player->latency_changed, 1, __ATOMIC_RELEASE);
+  }
+}
+
+// picks up the synth's parameter list. the first num_known values are kept,
+// the others start from the synth's own values. plugins without get start
+// at the bottom of the range until the first change.
+static void player_update_params(struct player* player, int num_known) {
+  struct paramdesc const* params = player->synthdesc ? player->synthdesc->params : NULL;
+  unsigned seq = player->params_seq;
+  __atomic_store_n(&player->params_seq, seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  int num_params = 0;
+  for(int i=0;params && params[i].name && i<PLAYER_MAX_PARAMS;i++) {
+    if (i >= num_known) {
+      float value = params[i].get ? params[i].get(player->synthstate) : params[i].min;
+      __atomic_store(&player->param_values[i], &value, __ATOMIC_RELAXED);
+    }
+    struct playerparam* copy = &player->params[i];
+    snprintf(copy->name, sizeof(copy->name), "%s", params[i].name);
+    snprintf(copy->unit, sizeof(copy->unit), "%s", params[i].unit ? params[i].unit : "");
+    copy->min = params[i].min;
+    copy->max = params[i].max;
+    copy->isenum = params[i].isenum;
+    num_params = i+1;
+  }
+  __atomic_store_n(&player->num_params, num_params, __ATOMIC_RELAXED);
+  __atomic_store_n(&player->params_seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+int player_init(struct player* player, struct song* song, struct synthdesc const* synthdesc, struct synthdesc const* effectdesc, int samplerate, int rtpriority) {
   memset(player,0,sizeof(*player));
   songcursor_init(&player->cursor);
   if (pthread_mutex_init(&player->mutex,NULL))
@@ -12,13 +58,15 @@ int player_init(struct player* player, struct song* song, struct synthdesc const
   player->song = song;
   player->synthdesc = synthdesc;
   player->samples_per_tick = samplerate / 12;
+  player->samplerate = samplerate;
   
-  if (!player->synthdesc) {
-    fprintf(stderr,"Couldn't load synth plugin dll\n");
+  if (taskpool_init(&player->taskpool,-1,rtpriority)) {
+    fprintf(stderr,"Couldn't start worker threads\n");
     return 1;
   }
 
-  if (synthdesc_instantiate(player->synthdesc,samplerate,&player->synthstate)) {
+  if (player->synthdesc &&
+      synthdesc_instantiate(player->synthdesc,samplerate,&player->taskpool.host,&player->synthstate)) {
     fprintf(stderr,"Couldn't instantiate synth plugin\n");
     return 1;
   }
@@ -26,25 +74,47 @@ int player_init(struct player* player, struct song* song, struct synthdesc const
   player->effectdesc = effectdesc;
 
   if (player->effectdesc) {
-    if (synthdesc_instantiate(player->effectdesc,samplerate,&player->effectstate)) {
+    if (synthdesc_instantiate(player->effectdesc,samplerate,&player->taskpool.host,&player->effectstate)) {
       fprintf(stderr,"Couldn't instantiate reverb4 plugin\n");
       return 1;
     }
   }
+  player_update_params(player,0);
+  player_update_plugin_info(player);
+  player->fade_length = (int)(PLAYER_CROSSFADE * samplerate);
+  if (player->fade_length < 1)
+    player->fade_length = 1;
 
   return 0;
 }
 
+void pluginswap_free(struct pluginswap* swap) {
+  if (!swap)
+    return;
+  synthdesc_deinstantiate(swap->desc,&swap->state);
+  synthdesc_unload(swap->handle);
+  free(swap);
+}
+
 
 void player_finalize(struct player* player) {
   songcursor_finalize(&player->cursor);
   pthread_mutex_lock(&player->mutex);
-  synthdesc_deinstantiate(player->synthdesc,&player->synthstate);
+  if (player->synthdesc)
+    synthdesc_deinstantiate(player->synthdesc,&player->synthstate);
   player->synthdesc = NULL;
+  synthdesc_unload(player->synthhandle);
+  player->synthhandle = NULL;
   if (player->effectdesc) {
     synthdesc_deinstantiate(player->effectdesc,&player->effectstate);
     player->effectdesc = NULL;
   }
+  synthdesc_unload(player->effecthandle);
+  player->effecthandle = NULL;
+  pluginswap_free(player->pending_swap);
+  pluginswap_free(player->fading);
+  pluginswap_free(player->retired_swap);
+  taskpool_finalize(&player->taskpool);
   pthread_mutex_destroy(&player->mutex);
 }
 
@@ -58,42 +128,6 @@ static double calc_ji_freq(int octave, int degree) {
 }
 
 
-static double calc_freq(int octave, int degree, int edo) {
-  double multiplier = 0.0;
-  if (edo == 53) {
-    switch(degree) {
-    case 0: multiplier = 1.0; break;
-    case 7: multiplier = 35/32.0; break;
-    case 8: multiplier = 10.0/9.0; break;
-    case 9: multiplier = 9.0/8.0; break;
-    case 14: multiplier = 6.0/5.0; break;
-    case 17: multiplier = 5.0/4.0; break;
-    case 18: multiplier = 80.0/63.0; break; // 10/9 * 8/7 = 80/63
-    case 21: multiplier = 21.0/16.0; break;
-    case 22: multiplier = 4.0/3.0; break;
-    case 24: multiplier = 11.0/8.0; break;
-    case 25: multiplier = 25.0/18.0; break; // 5/3 * 5/3 * 1/2
-    case 26: multiplier = 45.0/32.0; break;
-    case 29: multiplier = 35.0/24.0; break;
-    case 31: multiplier = 3.0/2.0; break;
-    case 34: multiplier = 25.0/16.0; break;
-    case 36: multiplier = 8.0/5.0; break;
-    case 37: multiplier = 13.0/8.0; break;
-    case 39: multiplier = 5.0/3.0; break;
-    case 40: multiplier = 27.0/16.0; break;
-    case 43: multiplier = 7.0/4.0; break;
-    case 44: multiplier = 16.0/9.0; break;
-    case 45: multiplier = 9.0/5.0; break;
-    case 48: multiplier = 15.0/8.0; break;
-    case 49: multiplier = 40.0/21.0; break; // 5/3 * 8/7 = 40/21
-    }
-  }
-  if (multiplier > 0)
-    return pow(2.0, octave) * multiplier;
-  else
-    return pow(2,octave+(double)degree/edo);
-}
-
 void player_track_handle_event(struct player* player, int track, struct event event) {
   switch(event.cmd) {
   case CMD_NOP:
@@ -108,7 +142,7 @@ void player_track_handle_event(struct player* player, int track, struct event ev
       player->synthdesc->noteoff(player->synthstate,track);
     }
     if (player->synthdesc && player->synthdesc->noteon) {
-      double freq = 8 * calc_freq(event.octave, event.degree, 53);
+      double freq = tuning_freq(&player->song->tuning, event.octave, event.degree);
       player->synthdesc->noteon(player->synthstate,track,freq,0.5);
     }
     break;
@@ -127,10 +161,20 @@ void player_track_handle_event(struct player* player, int track, struct event ev
       player->synthdesc->noteoff(player->synthstate,track);
     }
     if (player->synthdesc && player->synthdesc->noteon) {
-      double freq = 8 * calc_freq(event.octave, event.degree, 31);
+      double freq = tuning_freq(&player->song->tuning_31_edo, event.octave, event.degree);
       player->synthdesc->noteon(player->synthstate,track,freq,0.5);
     }
     break;
+  case CMD_SCALE_NOTE_ON:
+    if (player->synthdesc && player->synthdesc->noteoff) {
+      player->synthdesc->noteoff(player->synthstate,track);
+    }
+    if (player->synthdesc && player->synthdesc->noteon) {
+      double freq = tuning_freq(&player->song->tuning_scale, event.octave, event.degree);
+      if (freq > 0) // unmapped keys are silent
+        player->synthdesc->noteon(player->synthstate,track,freq,0.5);
+    }
+    break;
   }
 }
 
@@ -144,25 +188,203 @@ void player_tick(struct player* player) {
   player_advance_cursor(player);
 }
 
+static void clear_block(float* const* outs, int length) {
+  for(int i=0;i<length;i++) {
+    outs[0][i] = 0;
+    outs[1][i] = 0;
+  }
+}
+
+// installs a pending swap. afterwards the swap holds the old instance,
+// which keeps playing until the crossfade is done.
+static void player_take_swap(struct player* player) {
+  if (player->fading)
+    return;
+  struct pluginswap* swap = __atomic_exchange_n(&player->pending_swap, NULL, __ATOMIC_ACQUIRE);
+  if (!swap)
+    return;
+  struct synthdesc const* desc = swap->desc;
+  void* state = swap->state;
+  void* handle = swap->handle;
+  if (swap->effect) {
+    swap->desc = player->effectdesc;
+    swap->state = player->effectstate;
+    swap->handle = player->effecthandle;
+    player->effectdesc = desc;
+    player->effectstate = state;
+    player->effecthandle = handle;
+  }
+  else {
+    swap->desc = player->synthdesc;
+    swap->state = player->synthstate;
+    swap->handle = player->synthhandle;
+    player->synthdesc = desc;
+    player->synthstate = state;
+    player->synthhandle = handle;
+    // the new synth gets the values set so far
+    int num_known = player->num_params;
+    player_update_params(player,num_known);
+    if (num_known > 0)
+      __atomic_fetch_or(&player->params_changed, ~0u >> (32 - num_known), __ATOMIC_RELAXED);
+  }
+  player_update_plugin_info(player);
+  player->fading = swap;
+  // nothing to fade from if the slot was empty
+  player->fade_position = swap->desc ? 0 : player->fade_length;
+}
+
+// goes from the fading instance's output in fade_left and fade_right to
+// what is in outs over the length of the crossfade
+static void player_crossfade(struct player* player, float* const* outs, int length) {
+  float const step = 1.0f / player->fade_length;
+  float gain = player->fade_position * step;
+  for(int i=0;i<length;i++) {
+    if (gain > 1)
+      gain = 1;
+    outs[0][i] = player->fade_left[i] + (outs[0][i] - player->fade_left[i]) * gain;
+    outs[1][i] = player->fade_right[i] + (outs[1][i] - player->fade_right[i]) * gain;
+    gain += step;
+  }
+}
+
+// fades the old synth's output in outs out over the length of the
+// crossfade. the new synth is a fresh instance whose notes all start after
+// the swap, so it is added on top at full level instead of faded in.
+static void player_fade_out(struct player* player, float* const* outs, int length) {
+  float const step = 1.0f / player->fade_length;
+  float gain = 1 - player->fade_position * step;
+  for(int i=0;i<length;i++) {
+    if (gain < 0)
+      gain = 0;
+    outs[0][i] *= gain;
+    outs[1][i] *= gain;
+    gain -= step;
+  }
+}
+
+// adds the plugin's output to outs, through scratch if it has no
+// processadding
+static void player_process_adding(struct synthdesc const* desc, void* state, int length,
+                                  float const* const* ins, float* const* outs, float* const* scratch) {
+  if (desc->processadding) {
+    desc->processadding(state, length, ins, outs);
+    return;
+  }
+  desc->process(state, length, ins, scratch);
+  for(int i=0;i<length;i++) {
+    outs[0][i] += scratch[0][i];
+    outs[1][i] += scratch[1][i];
+  }
+}
+
+// hands the old instance back once the fade is over and the previous
+// one has been collected
+static void player_advance_fade(struct player* player, int length) {
+  struct pluginswap* fading = player->fading;
+  if (!fading)
+    return;
+  player->fade_position += length;
+  if (player->fade_position >= player->fade_length &&
+      __atomic_load_n(&player->retired_swap, __ATOMIC_ACQUIRE) == NULL) {
+    __atomic_store_n(&player->retired_swap, fading, __ATOMIC_RELEASE);
+    player->fading = NULL;
+  }
+}
+
 void player_generate_audio_block(struct player* player, float* out_left, float* out_right, int length) {
   
+  player_take_swap(player);
+
+  // silent until there is a synth, it may still be instantiating
   if (!player->synthdesc || !player->synthdesc->process) {
     for(int i=0;i<length;i++) {
       out_left[i] = 0;
       out_right[i] = 0;
     }
+    player_advance_fade(player, length);
     return;
   }
 
   float* outs[] = { out_left, out_right };
 
-  player->synthdesc->process(player->synthstate, length, NULL, outs);
+  // the synth renders straight into out and the effect works on it there,
+  // unless the effect can't work in place or an old effect fading out
+  // needs the same input
+  struct pluginswap* fading = player->fading;
+  int fading_synth = fading && fading->desc && !fading->effect;
+  int fading_effect = fading && fading->desc && fading->effect;
+  int has_effect = player->effectdesc && player->effectdesc->process;
+  int inplace = !has_effect || ((player->effectdesc->flags & SYNTHDESC_INPLACE) && !fading_effect);
+  float* synthouts[] = {
+    inplace ? out_left : player->scratch_left,
+    inplace ? out_right : player->scratch_right
+  };
+
+  // idle plugins are not run at all, their output is known to be silent
+  int silent = player->synthdesc->isidle && player->synthdesc->isidle(player->synthstate);
+
+  if (has_effect && silent && !fading && player->effect_tail >= 0 &&
+      player->effect_silent_input >= player->effect_tail) {
+    // tail has died out, silent in gives silent out
+    clear_block(outs, length);
+    return;
+  }
 
-  float const* const ins[] = { outs[0], outs[1] };
+  unsigned changed = __atomic_exchange_n(&player->params_changed, 0, __ATOMIC_ACQUIRE);
+  if (changed) {
+    struct paramevent events[PLAYER_MAX_PARAMS];
+    int num_events = 0;
+    for(int i=0;i<player->num_params;i++) {
+      if (changed & (1u << i)) {
+        struct paramevent* e = &events[num_events++];
+        e->offset = 0;
+        e->param = i;
+        __atomic_load(&player->param_values[i], &e->target, __ATOMIC_RELAXED);
+        e->ramplength = (int)(PLAYER_PARAM_RAMP * player->samplerate);
+      }
+    }
+    synthdesc_paramevents(player->synthdesc, player->synthstate, num_events, events);
+  }
+
+  float* fadeouts[] = { player->fade_left, player->fade_right };
+  if (fading_synth && !(fading->desc->isidle && fading->desc->isidle(fading->state))) {
+    // the old synth's notes die away under the new one
+    fading->desc->process(fading->state, length, NULL, synthouts);
+    player_fade_out(player, synthouts, length);
+    if (!silent)
+      player_process_adding(player->synthdesc, player->synthstate, length, NULL, synthouts, fadeouts);
+  }
+  else if (silent) {
+    clear_block(synthouts, length);
+  }
+  else {
+    player->synthdesc->process(player->synthstate, length, NULL, synthouts);
+  }
 
-  if (player->effectdesc && player->effectdesc->process) {
+  if (has_effect) {
+    if (silent)
+      player->effect_silent_input += length;
+    else
+      player->effect_silent_input = 0;
+    float const* const ins[] = { synthouts[0], synthouts[1] };
     player->effectdesc->process(player->effectstate, length, ins, outs);
+    if (fading_effect) {
+      fading->desc->process(fading->state, length, ins, fadeouts);
+      player_crossfade(player, outs, length);
+    }
   }
+
+  player_advance_fade(player, length);
+}
+
+int player_swap_plugin(struct player* player, struct pluginswap* swap) {
+  struct pluginswap* expected = NULL;
+  return !__atomic_compare_exchange_n(&player->pending_swap, &expected, swap, 0,
+                                      __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+}
+
+struct pluginswap* player_take_retired(struct player* player) {
+  return __atomic_exchange_n(&player->retired_swap, NULL, __ATOMIC_ACQUIRE);
 }
 
 void player_handle_events(struct player* player) {
@@ -179,11 +401,15 @@ int player_generate_some_audio(struct player* player, float* out_left, float* ou
   if (maxlength <= 0)
     return 0;
   
+  util_flush_denormals();
+
   pthread_mutex_lock(&player->mutex);
 
   player_handle_events(player);
 
   int block_length = maxlength;
+  if (block_length > PLAYER_MAX_BLOCK)
+    block_length = PLAYER_MAX_BLOCK;
   if (player->playing) {
     if (block_length > player->distance_to_next_tick)
       block_length = player->distance_to_next_tick;
@@ -241,10 +467,74 @@ int player_is_at_beginning_of_song(struct player* player) {
   return answer;
 }
 
+int player_num_synth_params(struct player* player) {
+  return __atomic_load_n(&player->num_params, __ATOMIC_RELAXED);
+}
+
+// retries until it has read the list without a swap in between
+int player_synth_param_desc(struct player* player, int param, struct playerparam* out) {
+  while (1) {
+    unsigned seq = __atomic_load_n(&player->params_seq, __ATOMIC_ACQUIRE);
+    if (seq & 1)
+      continue;
+    int num_params = __atomic_load_n(&player->num_params, __ATOMIC_RELAXED);
+    if (param >= 0 && param < num_params)
+      memcpy(out, &player->params[param], sizeof(*out));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&player->params_seq, __ATOMIC_RELAXED) == seq)
+      return param < 0 || param >= num_params;
+  }
+}
+
+float player_get_synth_param(struct player* player, int param) {
+  float value;
+  __atomic_load(&player->param_values[param], &value, __ATOMIC_RELAXED);
+  return value;
+}
+
+void player_set_synth_param(struct player* player, int param, float value) {
+  if (param < 0 || param >= player_num_synth_params(player))
+    return;
+  __atomic_store(&player->param_values[param], &value, __ATOMIC_RELAXED);
+  __atomic_fetch_or(&player->params_changed, 1u << param, __ATOMIC_RELEASE);
+}
+
+int player_latency(struct player* player) {
+  return __atomic_load_n(&player->latency, __ATOMIC_RELAXED);
+}
+
+int player_take_latency_change(struct player* player) {
+  return __atomic_exchange_n(&player->latency_changed, 0, __ATOMIC_ACQUIRE);
+}
+
 void player_begin_song_edit(struct player* player) {
   pthread_mutex_lock(&player->mutex);
 }
 
 void player_end_song_edit(struct player* player) {
+  player->song_version++;
+  pthread_mutex_unlock(&player->mutex);
+}
+
+void player_apply_transaction(struct player* player, struct songtransaction const* t) {
+  if (t->num_edits == 0)
+    return;
+  player_begin_song_edit(player);
+  song_apply_transaction(player->song, t);
+  player_end_song_edit(player);
+}
+
+unsigned player_snapshot_song(struct player* player, struct song* out) {
+  pthread_mutex_lock(&player->mutex);
+  memcpy(out, player->song, sizeof(*out));
+  unsigned version = player->song_version;
+  pthread_mutex_unlock(&player->mutex);
+  return version;
+}
+
+unsigned player_song_version(struct player* player) {
+  pthread_mutex_lock(&player->mutex);
+  unsigned version = player->song_version;
   pthread_mutex_unlock(&player->mutex);
+  return version;
 }
@@ -1,8 +1,31 @@
 #include "synthdesc.h"
 #include "synths.h"
 #include "song.h"
+#include "taskpool.h"
 #include <pthread.h>
 
+#define PLAYER_MAX_BLOCK 1024 // longest block passed to plugins
+#define PLAYER_MAX_PARAMS 32 // synth parameters the player can change
+#define PLAYER_PARAM_RAMP 0.05 // seconds the synth takes to follow a change
+#define PLAYER_CROSSFADE 0.02 // seconds a swapped in plugin fades in over
+
+// a copy of one of the synth's parameter descriptions. the copy stays
+// valid when the plugin library it came from is unloaded.
+struct playerparam {
+  char name[32];
+  char unit[16];
+  double min,max;
+  int isenum;
+};
+
+// a plugin instance on its way into or out of the player
+struct pluginswap {
+  struct synthdesc const* desc;
+  void* state;
+  void* handle; // from synthdesc_load_copy, or NULL
+  int effect; // replaces the effect rather than the synth
+};
+
 struct player {
   struct song* song;
   char playing;
@@ -10,16 +33,56 @@ struct player {
 
   int distance_to_next_tick;
   int samples_per_tick;
+  int samplerate;
 
   pthread_mutex_t mutex;
+  unsigned song_version; // incremented by every song edit
 
   struct synthdesc const* synthdesc;
   void* synthstate;
+  void* synthhandle; // from synthdesc_load_copy, NULL if not known
   struct synthdesc const* effectdesc;
   void* effectstate;
+  void* effecthandle;
+  int effect_tail; // in samples, -1 if the effect never may be skipped
+  int effect_silent_input; // samples of silent input the effect has had
+  int latency; // samples from a note event until it is heard, synth and effect together
+  int latency_changed; // set by a swap that changed latency
+
+  struct taskpool taskpool; // offered to the plugins for parallel work
+
+  // synth parameter values. written by the editor with atomics, never
+  // under the lock, and picked up by the audio thread once per block.
+  int num_params;
+  float param_values[PLAYER_MAX_PARAMS];
+  unsigned params_changed; // one bit per parameter
+  // the synth's parameter list as other threads see it. rewritten by the
+  // audio thread when a synth is swapped in, with params_seq odd while
+  // that is going on.
+  unsigned params_seq;
+  struct playerparam params[PLAYER_MAX_PARAMS];
+
+  // plugin hot swapping. a swap is handed over in pending_swap and taken
+  // by the audio thread at the start of a block. the replaced instance
+  // keeps playing in fading for the crossfade, then waits in retired_swap
+  // to be finalized off the audio thread.
+  struct pluginswap* pending_swap;
+  struct pluginswap* fading;
+  int fade_length;
+  int fade_position;
+  struct pluginswap* retired_swap;
+  float fade_left[PLAYER_MAX_BLOCK];
+  float fade_right[PLAYER_MAX_BLOCK];
+
+  // synth output for effects that can't process in place
+  float scratch_left[PLAYER_MAX_BLOCK];
+  float scratch_right[PLAYER_MAX_BLOCK];
 };
 
-int player_init(struct player* player, struct song* song, struct synthdesc const* synthdesc, struct synthdesc const* effectdesc, int samplerate);
+// with a NULL synthdesc the player is silent until a synth is swapped in.
+// rtpriority is the realtime priority of the audio thread, 0 if it has
+// none. the plugins' worker threads get the same.
+int player_init(struct player* player, struct song* song, struct synthdesc const* synthdesc, struct synthdesc const* effectdesc, int samplerate, int rtpriority);
 void player_finalize(struct player* player);
 void player_advance_cursor(struct player* player);
 void player_track_handle_event(struct player* player, int track, struct event event);
@@ -34,8 +97,40 @@ void player_play(struct player* player);
 void player_stop(struct player* player);
 void player_play_from(struct player* player, struct songcursor const* cursor);
 int player_is_at_beginning_of_song(struct player* player);
+// samples the audio lags behind the song position
+int player_latency(struct player* player);
+// returns 1 once after a swapped in plugin changed the latency
+int player_take_latency_change(struct player* player);
+
+// the synth's parameters, safe to call from any thread without blocking
+// the audio thread. the synth glides to a new value over PLAYER_PARAM_RAMP.
+int player_num_synth_params(struct player* player);
+// copies the description of the parameter to out. returns 1 if there is
+// no such parameter.
+int player_synth_param_desc(struct player* player, int param, struct playerparam* out);
+float player_get_synth_param(struct player* player, int param);
+void player_set_synth_param(struct player* player, int param, float value);
+
+// hands a new plugin instance to the audio thread, which swaps it in at the
+// next block. an old synth fades out under the new one, an old effect is
+// crossfaded into the new one. returns 1 if the previous
+// swap hasn't been taken yet.
+int player_swap_plugin(struct player* player, struct pluginswap* swap);
+// returns the instance replaced by a finished swap, NULL if there is none.
+// the caller finalizes and unloads it.
+struct pluginswap* player_take_retired(struct player* player);
+// finalizes the instance, unloads its library and frees the swap
+void pluginswap_free(struct pluginswap* swap);
 
 // any code block that modifies the player's song must be surrounded by
 // calls to these.
 void player_begin_song_edit(struct player* player);
 void player_end_song_edit(struct player* player);
+
+// applies all edits of the transaction under a single lock acquisition
+void player_apply_transaction(struct player* player, struct songtransaction const* t);
+
+// copies the song while holding the player lock, so the copy never
+// contains a half-done edit. returns the song version of the copy.
+unsigned player_snapshot_song(struct player* player, struct song* out);
+unsigned player_song_version(struct player* player);
@@ -0,0 +1,150 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include "reloader.h"
+#include "player.h"
+
+#define PLUGIN_DIR "../plugins"
+
+static int reloader_quitting(struct reloader* reloader) {
+  return __atomic_load_n(&reloader->quit, __ATOMIC_ACQUIRE);
+}
+
+// finalizes the instances the player is done with
+static void reloader_collect(struct reloader* reloader) {
+  struct pluginswap* old;
+  while ((old = player_take_retired(reloader->player)))
+    pluginswap_free(old);
+  if (player_take_latency_change(reloader->player) && reloader->latency_changed)
+    reloader->latency_changed(reloader->latency_arg);
+}
+
+static int is_plugin_file(const char* filename, const char* name) {
+  char buffer[1024];
+  snprintf(buffer,1024,"%s.so",name);
+  return strcmp(filename,buffer) == 0;
+}
+
+// instantiates desc and hands it to the player. handle is unloaded with
+// the instance, NULL if the library stays loaded.
+static void reloader_publish(struct reloader* reloader, struct synthdesc const* desc, void* handle, int effect) {
+  struct player* player = reloader->player;
+  struct pluginswap* swap = malloc(sizeof(*swap));
+  if (!swap) {
+    synthdesc_unload(handle);
+    return;
+  }
+  swap->effect = effect;
+  swap->state = NULL;
+  swap->desc = desc;
+  swap->handle = handle;
+  if (synthdesc_instantiate(swap->desc,player->samplerate,&player->taskpool.host,&swap->state)) {
+    fprintf(stderr,"Couldn't instantiate %s plugin\n",effect ? reloader->effect : reloader->synth);
+    synthdesc_unload(swap->handle);
+    free(swap);
+    return;
+  }
+  // one swap at a time, the audio thread takes it within a block or two
+  while (player_swap_plugin(player,swap)) {
+    if (reloader_quitting(reloader)) {
+      pluginswap_free(swap);
+      return;
+    }
+    usleep(10000);
+    reloader_collect(reloader);
+  }
+}
+
+static void reloader_reload(struct reloader* reloader, const char* name, int effect) {
+  void* handle;
+  struct synthdesc const* desc = synthdesc_load_copy(name,&handle);
+  if (!desc)
+    return;
+  if (!desc->process) {
+    fprintf(stderr,"%s has no process function, not reloading\n",name);
+    synthdesc_unload(handle);
+    return;
+  }
+  reloader_publish(reloader,desc,handle,effect);
+}
+
+static void* reloader_thread(void* arg) {
+  struct reloader* reloader = arg;
+  char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  // the first instances come from the libraries loaded at startup
+  reloader_publish(reloader,reloader->synthdesc,NULL,0);
+  if (reloader->effectdesc && !reloader_quitting(reloader))
+    reloader_publish(reloader,reloader->effectdesc,NULL,1);
+  while (!reloader_quitting(reloader)) {
+    // poll ignores a negative fd, then this only collects
+    struct pollfd pollfd = { reloader->inotify_fd, POLLIN, 0 };
+    int ready = poll(&pollfd,1,100);
+    reloader_collect(reloader);
+    if (ready <= 0)
+      continue;
+    ssize_t length = read(reloader->inotify_fd,buffer,sizeof(buffer));
+    int reload_synth = 0;
+    int reload_effect = 0;
+    for (char* p = buffer; p < buffer + length;) {
+      struct inotify_event const* event = (struct inotify_event const*)p;
+      if (event->len > 0) {
+        if (is_plugin_file(event->name,reloader->synth))
+          reload_synth = 1;
+        if (reloader->effect && is_plugin_file(event->name,reloader->effect))
+          reload_effect = 1;
+      }
+      p += sizeof(struct inotify_event) + event->len;
+    }
+    if (reload_synth)
+      reloader_reload(reloader,reloader->synth,0);
+    if (reload_effect)
+      reloader_reload(reloader,reloader->effect,1);
+  }
+  return NULL;
+}
+
+int reloader_init(struct reloader* reloader, struct player* player,
+                  const char* synth, struct synthdesc const* synthdesc,
+                  const char* effect, struct synthdesc const* effectdesc,
+                  int watch, void (*latency_changed)(void* arg), void* latency_arg) {
+  reloader->player = player;
+  reloader->latency_changed = latency_changed;
+  reloader->latency_arg = latency_arg;
+  reloader->synth = synth;
+  reloader->effect = effect;
+  reloader->synthdesc = synthdesc;
+  reloader->effectdesc = effectdesc;
+  reloader->quit = 0;
+  reloader->inotify_fd = -1;
+  if (watch) {
+    reloader->inotify_fd = inotify_init1(IN_CLOEXEC);
+    if (reloader->inotify_fd < 0) {
+      perror("inotify_init1");
+      return 1;
+    }
+    // the linker either rewrites the file or moves a new one in place
+    if (inotify_add_watch(reloader->inotify_fd,PLUGIN_DIR,IN_CLOSE_WRITE|IN_MOVED_TO) < 0) {
+      perror(PLUGIN_DIR);
+      close(reloader->inotify_fd);
+      return 1;
+    }
+  }
+  if (pthread_create(&reloader->thread,NULL,reloader_thread,reloader)) {
+    fprintf(stderr,"Couldn't start reloader thread\n");
+    if (reloader->inotify_fd >= 0)
+      close(reloader->inotify_fd);
+    return 1;
+  }
+  return 0;
+}
+
+void reloader_finalize(struct reloader* reloader) {
+  __atomic_store_n(&reloader->quit,1,__ATOMIC_RELEASE);
+  pthread_join(reloader->thread,NULL);
+  reloader_collect(reloader);
+  if (reloader->inotify_fd >= 0)
+    close(reloader->inotify_fd);
+}
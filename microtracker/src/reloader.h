@@ -0,0 +1,36 @@
+#ifndef RELOADER_H_INCLUDED
+#define RELOADER_H_INCLUDED
+
+#include <pthread.h>
+
+struct player;
+
+struct synthdesc;
+
+// Instantiates the synth and effect in the background and swaps them into
+// the player, so a big plugin doesn't hold up the editor. With watch set it
+// then keeps watching the plugins directory and swaps in a rebuilt synth or
+// effect while the player plays. Loading, instantiating and finalizing
+// happen on the reloader's thread, the audio thread only swaps pointers.
+struct reloader {
+  struct player* player;
+  const char* synth;
+  const char* effect; // NULL if there is none
+  struct synthdesc const* synthdesc;
+  struct synthdesc const* effectdesc; // NULL if there is none
+  // called on the reloader's thread after a swap changed the player's
+  // latency, so the audio interface can report the new one. may be NULL.
+  void (*latency_changed)(void* arg);
+  void* latency_arg;
+  int inotify_fd; // -1 if not watching
+  pthread_t thread;
+  int quit;
+};
+
+int reloader_init(struct reloader* reloader, struct player* player,
+                  const char* synth, struct synthdesc const* synthdesc,
+                  const char* effect, struct synthdesc const* effectdesc,
+                  int watch, void (*latency_changed)(void* arg), void* latency_arg);
+void reloader_finalize(struct reloader* reloader);
+
+#endif
@@ -0,0 +1,129 @@
+#include <stdio.h>
+#include <time.h>
+#include <errno.h>
+#include "saver.h"
+#include "player.h"
+
+// writes the song itself, making it clean
+static void saver_save(struct saver* saver) {
+  unsigned version = player_snapshot_song(saver->player, &saver->snapshot);
+  if (song_save_atomic(&saver->snapshot, saver->filename))
+    return;
+  pthread_mutex_lock(&saver->mutex);
+  saver->saved_version = version;
+  saver->autosaved_version = version;
+  pthread_mutex_unlock(&saver->mutex);
+}
+
+// writes the unsaved edits to the recovery file next to the song, which
+// stays as it was last saved, so that quitting without saving still
+// discards them
+static int saver_autosave(struct saver* saver) {
+  char recovery[1024];
+  if (snprintf(recovery,sizeof(recovery),"%s.autosave",saver->filename) >= (int)sizeof(recovery))
+    return 1;
+  unsigned version = player_snapshot_song(saver->player, &saver->snapshot);
+  if (song_save_atomic(&saver->snapshot, recovery))
+    return 1;
+  pthread_mutex_lock(&saver->mutex);
+  saver->autosaved_version = version;
+  pthread_mutex_unlock(&saver->mutex);
+  return 0;
+}
+
+static void* saver_thread(void* arg) {
+  struct saver* saver = arg;
+  pthread_mutex_lock(&saver->mutex);
+  while (1) {
+    if (saver->save_requested) {
+      saver->save_requested = 0;
+    }
+    else if (saver->autosave_interval > 0) {
+      struct timespec deadline;
+      clock_gettime(CLOCK_REALTIME, &deadline);
+      deadline.tv_sec += saver->autosave_interval;
+      int err = 0;
+      while (!saver->save_requested && !saver->quit && err != ETIMEDOUT)
+        err = pthread_cond_timedwait(&saver->cond, &saver->mutex, &deadline);
+      if (saver->quit)
+        break;
+      if (!saver->save_requested) {
+        unsigned version = player_song_version(saver->player);
+        if (version == saver->saved_version || version == saver->autosaved_version)
+          continue;
+        pthread_mutex_unlock(&saver->mutex);
+        saver_autosave(saver);
+        pthread_mutex_lock(&saver->mutex);
+        continue;
+      }
+      saver->save_requested = 0;
+    }
+    else {
+      while (!saver->save_requested && !saver->quit)
+        pthread_cond_wait(&saver->cond, &saver->mutex);
+      if (saver->quit)
+        break;
+      saver->save_requested = 0;
+    }
+    pthread_mutex_unlock(&saver->mutex);
+    saver_save(saver);
+    pthread_mutex_lock(&saver->mutex);
+  }
+  pthread_mutex_unlock(&saver->mutex);
+  return NULL;
+}
+
+int saver_init(struct saver* saver, struct player* player, const char* filename, int autosave_interval) {
+  saver->player = player;
+  saver->filename = filename;
+  saver->autosave_interval = autosave_interval;
+  saver->save_requested = 0;
+  saver->quit = 0;
+  saver->saved_version = player_song_version(player);
+  saver->autosaved_version = saver->saved_version;
+  if (pthread_mutex_init(&saver->mutex,NULL))
+    return 1;
+  if (pthread_cond_init(&saver->cond,NULL)) {
+    pthread_mutex_destroy(&saver->mutex);
+    return 1;
+  }
+  if (pthread_create(&saver->thread,NULL,saver_thread,saver)) {
+    fprintf(stderr,"Couldn't start saver thread\n");
+    pthread_cond_destroy(&saver->cond);
+    pthread_mutex_destroy(&saver->mutex);
+    return 1;
+  }
+  return 0;
+}
+
+void saver_finalize(struct saver* saver) {
+  pthread_mutex_lock(&saver->mutex);
+  saver->quit = 1;
+  pthread_cond_signal(&saver->cond);
+  pthread_mutex_unlock(&saver->mutex);
+  pthread_join(saver->thread,NULL);
+  // with autosave on, unsaved edits survive quitting in the recovery file
+  if (saver->autosave_interval > 0 &&
+      player_song_version(saver->player) != saver->saved_version) {
+    if (player_song_version(saver->player) == saver->autosaved_version ||
+        !saver_autosave(saver))
+      fprintf(stderr,"Unsaved changes were kept in %s.autosave\n",saver->filename);
+  }
+  pthread_cond_destroy(&saver->cond);
+  pthread_mutex_destroy(&saver->mutex);
+}
+
+void saver_request_save(struct saver* saver) {
+  pthread_mutex_lock(&saver->mutex);
+  saver->save_requested = 1;
+  pthread_cond_signal(&saver->cond);
+  pthread_mutex_unlock(&saver->mutex);
+}
+
+void saver_mark_clean(struct saver* saver) {
+  unsigned version = player_song_version(saver->player);
+  pthread_mutex_lock(&saver->mutex);
+  saver->saved_version = version;
+  saver->autosaved_version = version;
+  pthread_mutex_unlock(&saver->mutex);
+}
@@ -0,0 +1,36 @@
+#ifndef SAVER_H_INCLUDED
+#define SAVER_H_INCLUDED
+
+#include <pthread.h>
+#include "song.h"
+
+struct player;
+
+// Saves the player's song on a background thread so the editor never
+// waits for the disk. Saves happen on request. If autosave_interval is
+// nonzero, the unsaved edits are also written every autosave_interval
+// seconds, and on quitting, to <filename>.autosave, leaving the song file
+// itself alone until the user saves.
+struct saver {
+  struct player* player;
+  const char* filename;
+  int autosave_interval; // seconds, 0 disables autosave
+
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  char save_requested;
+  char quit;
+  unsigned saved_version; // song version last written to filename
+  unsigned autosaved_version; // song version last written to the recovery file
+
+  struct song snapshot; // only touched by the saver thread
+};
+
+int saver_init(struct saver* saver, struct player* player, const char* filename, int autosave_interval);
+void saver_finalize(struct saver* saver);
+void saver_request_save(struct saver* saver);
+// call after the song has been loaded from disk
+void saver_mark_clean(struct saver* saver);
+
+#endif
@@ -1,36 +1,113 @@
+#include <assert.h>
 #include <stdio.h>
+#include <stddef.h>
 #include <memory.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
 #include "song.h"
 #include "util.h"
 
+// the song file holds everything up to and including the patterns
+#define SONG_FILE_SIZE (offsetof(struct song, patterns) + sizeof(pattern) * SONG_PATTERNS)
+
 void song_init(struct song* song) {
   memset(song,0,sizeof(*song));
   for(int i=0;i<MAX_ORDER_LENGTH;i++)
     song->order[i] = END_OF_ORDER;
   song->order[0] = 0;
   song->octave_divisions = 53;
+  song_update_order_cache(song);
+  song_update_tuning(song);
 }
 
 int song_save(struct song* song, const char* filename) {
   FILE* f = fopen(filename,"wb");
   if (!f)
     return 1;
-  int len = fwrite(song,1,sizeof(*song),f);
+  int len = fwrite(song,1,SONG_FILE_SIZE,f);
   fclose(f);
-  if (len != sizeof(*song)) {
+  if (len != SONG_FILE_SIZE) {
     fprintf(stderr, "Error: Could not save song! The song may not be loadable.\n");
     return 1;
   }
   return 0;
 }
 
+// syncs the directory holding filename, so that a rename in it is on disk
+static int sync_parent_dir(const char* filename) {
+  char dir[1024];
+  if (snprintf(dir,sizeof(dir),"%s",filename) >= (int)sizeof(dir))
+    return 1;
+  char* slash = strrchr(dir,'/');
+  if (!slash)
+    strcpy(dir,".");
+  else if (slash == dir)
+    dir[1] = 0;
+  else
+    *slash = 0;
+  int fd = open(dir,O_RDONLY|O_DIRECTORY);
+  if (fd < 0)
+    return 1;
+  int err = fsync(fd);
+  close(fd);
+  return err != 0;
+}
+
+// Writes the song to a temporary file next to filename, syncs it to disk
+// and renames it over filename, so that a crash never leaves a truncated
+// song behind.
+int song_save_atomic(struct song* song, const char* filename) {
+  char tmpname[1024];
+  if (snprintf(tmpname,sizeof(tmpname),"%s.tmp",filename) >= (int)sizeof(tmpname))
+    return 1;
+  FILE* f = fopen(tmpname,"wb");
+  if (!f)
+    return 1;
+  int len = fwrite(song,1,SONG_FILE_SIZE,f);
+  int synced = fflush(f) == 0 && fsync(fileno(f)) == 0;
+  fclose(f);
+  if (len != SONG_FILE_SIZE || !synced) {
+    fprintf(stderr, "Error: Could not save song! The old song file was left untouched.\n");
+    remove(tmpname);
+    return 1;
+  }
+  if (rename(tmpname,filename)) {
+    remove(tmpname);
+    return 1;
+  }
+  if (sync_parent_dir(filename)) {
+    fprintf(stderr, "Error: Could not sync the directory of %s, the save may not survive a crash.\n", filename);
+    return 1;
+  }
+  return 0;
+}
+
+static int file_exists(const char* filename) {
+  return access(filename, R_OK) == 0;
+}
+
+static void song_load_scale(struct song* song, const char* filename) {
+  char scl[1024];
+  char kbm[1024];
+  if (snprintf(scl,sizeof(scl),"%s.scl",filename) >= (int)sizeof(scl) ||
+      snprintf(kbm,sizeof(kbm),"%s.kbm",filename) >= (int)sizeof(kbm))
+    return;
+  if (!file_exists(scl))
+    return;
+  tuning_load_scala(&song->tuning_scale, scl, file_exists(kbm) ? kbm : NULL);
+}
+
 int song_load(struct song* song, const char* filename) {
   FILE* f = fopen(filename,"rb");
   if (!f)
     return 1;
-  int len = fread(song,1,sizeof(*song),f);
+  int len = fread(song,1,SONG_FILE_SIZE,f);
   fclose(f);
-  if (len != sizeof(*song)) {
+  song_update_order_cache(song);
+  song_update_tuning(song);
+  song_load_scale(song, filename);
+  if (len != SONG_FILE_SIZE) {
     fprintf(stderr, "Error: Could not read whole song! The song may not be loaded correctly. len = %i\n", len);
     return 1;
   }
@@ -42,10 +119,49 @@ void song_finalize(struct song* song) {
 
 
 int song_order_length(struct song const* song) {
+  return song->order_length;
+}
+
+void song_update_order_cache(struct song* song) {
   int order_length = 0;
   while(order_length < MAX_ORDER_LENGTH && song->order[order_length] != END_OF_ORDER)
     order_length++;
-  return order_length;
+  song->order_length = order_length;
+
+  for(int i=0;i<SONG_PATTERNS;i++) {
+    song->pattern_uses[i] = 0;
+    song->pattern_first_use[i] = -1;
+  }
+  // walk backwards so each list comes out in order position order
+  for(int i=order_length-1;i>=0;i--) {
+    int pattern = song->order[i];
+    song->order_next_use[i] = song->pattern_first_use[pattern];
+    song->pattern_first_use[pattern] = i;
+    song->pattern_uses[pattern]++;
+  }
+}
+
+void song_update_tuning(struct song* song) {
+  tuning_init_edo(&song->tuning, song->octave_divisions);
+  tuning_init_edo(&song->tuning_31_edo, 31);
+  tuning_init_edo(&song->tuning_scale, 12);
+}
+
+void song_set_tuning(struct song* song, struct tuning const* tuning) {
+  song->octave_divisions = tuning->octave_divisions;
+  song->tuning = *tuning;
+}
+
+int song_pattern_use_count(struct song const* song, int pattern) {
+  return song->pattern_uses[pattern];
+}
+
+int song_pattern_first_use(struct song const* song, int pattern) {
+  return song->pattern_first_use[pattern];
+}
+
+int song_pattern_next_use(struct song const* song, int order_pos) {
+  return song->order_next_use[order_pos];
 }
 
 int song_pattern_line_is_empty(struct song const* song, int pattern, int line) {
@@ -84,6 +200,7 @@ void song_insert_order(struct song* song, int order_pos) {
     song->order[i] = prev;
     prev = curr;
   }
+  song_update_order_cache(song);
 }
 
 void song_delete_order(struct song* song, int order_pos) {
@@ -94,15 +211,19 @@ void song_delete_order(struct song* song, int order_pos) {
     order[i] = prev;
     prev = curr;
   }
+  song_update_order_cache(song);
 }
 void song_uniquify_pattern_at_order_pos(struct song* song, int order_pos) {
   uint8_t* order = song->order;
   uint8_t curr_pattern = order[order_pos];
+  if (song_pattern_use_count(song,curr_pattern) <= 1)
+    return; // already unique
   uint8_t free_pattern = song_first_empty_pattern(song);
   if (free_pattern < 0)
     return;
   song_copy_pattern(song,curr_pattern,free_pattern);
   order[order_pos] = free_pattern;
+  song_update_order_cache(song);
 };
 
 void songcursor_init(struct songcursor* cursor) {
@@ -142,6 +263,7 @@ void songcursor_move_pat_line(struct songcursor* cursor, struct song const* song
 void song_increment_order(struct song* song, int order_pos, int delta) {
   uint8_t* order = song->order;
   order[order_pos] = util_wrap(order[order_pos] + delta, END_OF_ORDER);
+  song_update_order_cache(song);
 }
 
 void songcursor_normalize(struct songcursor* cursor, struct song const* song) {
@@ -150,7 +272,7 @@ void songcursor_normalize(struct songcursor* cursor, struct song const* song) {
 }
 
 void songcursor_advance_pattern(struct songcursor* cursor, struct song const* song) {
-    if (cursor->order_pos == 255 || song->order[cursor->order_pos+1] == END_OF_ORDER) {
+    if (cursor->order_pos + 1 >= song->order_length) {
       cursor->order_pos = 0;
     }
     else {
@@ -192,6 +314,26 @@ int songcursor_pattern(struct songcursor const* cursor, struct song const* song)
   return song->order[cursor->order_pos];
 }
 
+void songtransaction_init(struct songtransaction* t) {
+  t->num_edits = 0;
+}
+
+void songtransaction_set_event(struct songtransaction* t, int pattern, int line, int track, struct event event) {
+  assert(t->num_edits < SONGTRANSACTION_MAX_EDITS);
+  struct songedit* edit = &t->edits[t->num_edits++];
+  edit->pattern = pattern;
+  edit->line = line;
+  edit->track = track;
+  edit->event = event;
+}
+
+void song_apply_transaction(struct song* song, struct songtransaction const* t) {
+  for(int i=0;i<t->num_edits;i++) {
+    struct songedit const* edit = &t->edits[i];
+    song->patterns[edit->pattern][edit->line][edit->track] = edit->event;
+  }
+}
+
 void song_get_line_events(struct song* song, struct songcursor const* cursor, struct event* out_events) {
   memcpy(out_events, &song->patterns[song->order[cursor->order_pos]][cursor->pat_line], PAT_TRACKS * sizeof(struct event));
 }
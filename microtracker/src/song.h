@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include "event.h"
+#include "tuning.h"
 
 #define PAT_LINES 64
 #define PAT_TRACKS 4
@@ -17,13 +18,37 @@ struct song {
   uint8_t octave_divisions;
   uint8_t order[256];
   pattern patterns[SONG_PATTERNS];
+
+  // Derived from order and not saved. Rebuilt by the song_* functions
+  // that change the order list.
+  short order_length;
+  short pattern_uses[SONG_PATTERNS]; // number of order positions using each pattern
+  short pattern_first_use[SONG_PATTERNS]; // first order position using each pattern, or -1
+  short order_next_use[MAX_ORDER_LENGTH]; // next order position with the same pattern, or -1
+
+  // Derived from octave_divisions and not saved.
+  struct tuning tuning; // for CMD_NOTE_ON
+  struct tuning tuning_31_edo; // for CMD_31_EDO_NOTE_ON
+  struct tuning tuning_scale; // for CMD_SCALE_NOTE_ON, see song_load
 };
 
 void song_init(struct song* song);
 int song_save(struct song* song, const char* filename);
+int song_save_atomic(struct song* song, const char* filename);
+// besides the song itself, loads the Scala scale <filename>.scl and
+// keyboard mapping <filename>.kbm into tuning_scale if they exist
 int song_load(struct song* song, const char* filename);
 void song_finalize(struct song* song);
 int song_order_length(struct song const* song);
+void song_update_order_cache(struct song* song);
+void song_update_tuning(struct song* song);
+// also sets octave_divisions, so the tuning can be built outside the player lock
+void song_set_tuning(struct song* song, struct tuning const* tuning);
+int song_pattern_use_count(struct song const* song, int pattern);
+// iterate over the order positions using a pattern with
+// for(pos = song_pattern_first_use(song,p); pos >= 0; pos = song_pattern_next_use(song,pos))
+int song_pattern_first_use(struct song const* song, int pattern);
+int song_pattern_next_use(struct song const* song, int order_pos);
 int song_pattern_line_is_empty(struct song const* song, int pattern, int line);
 int song_pattern_is_empty(struct song const* song, int pattern);
 int song_first_empty_pattern(struct song const* song);
@@ -52,6 +77,27 @@ int songcursor_order_pos(struct songcursor const* cursor);
 int songcursor_pattern_line(struct songcursor const* cursor);
 int songcursor_pattern(struct songcursor const* cursor, struct song const* song);
 
+// A batch of event changes that is built up without holding the player
+// lock and then applied to the song in one go. It holds one edit for every
+// event of a pattern, which is as much as any editor operation changes.
+#define SONGTRANSACTION_MAX_EDITS (PAT_LINES * PAT_TRACKS)
+
+struct songedit {
+  uint8_t pattern;
+  uint8_t line;
+  uint8_t track;
+  struct event event;
+};
+
+struct songtransaction {
+  int num_edits;
+  struct songedit edits[SONGTRANSACTION_MAX_EDITS];
+};
+
+void songtransaction_init(struct songtransaction* t);
+void songtransaction_set_event(struct songtransaction* t, int pattern, int line, int track, struct event event);
+void song_apply_transaction(struct song* song, struct songtransaction const* t);
+
 void song_get_line_events(struct song* song, struct songcursor const* cursor, struct event* out_events);
 
 struct event* song_line(struct song* song, struct songcursor const* cursor);
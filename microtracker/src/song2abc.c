@@ -2,6 +2,7 @@
 #include <getopt.h>
 #include <memory.h>
 #include <stdio.h>
+#include <math.h>
 #include "song.h"
 
 struct voice {
@@ -136,6 +137,16 @@ void voice_note_on(struct voice* voice, int octave, int degree) {
   voice->note_or_rest_start_pos = voice->current_pos;
 }
 
+// notation is in 53-EDO, so other tunings are spelled with the nearest
+// 53-EDO pitch of the frequency in the song's tuning table
+void voice_note_on_freq(struct voice* voice, double freq) {
+  int steps = (int)floor(53 * log2(freq / 8) + 0.5);
+  // below 8 Hz steps goes negative, so round the octave down and keep the
+  // degree in 0..52
+  int degree = ((steps % 53) + 53) % 53;
+  voice_note_on(voice, (steps - degree) / 53, degree);
+}
+
 void voice_advance(struct voice* voice) {
   voice->current_pos++;
   if (voice->current_pos == 16) {
@@ -168,7 +179,19 @@ void print_track(struct song* song, int track, const char* clef) {
       voice_note_off(&voice);
       break;
     case CMD_NOTE_ON:
-      voice_note_on(&voice, event->octave, event->degree);
+      if (song->octave_divisions == 53)
+        voice_note_on(&voice, event->octave, event->degree);
+      else
+        voice_note_on_freq(&voice, tuning_freq(&song->tuning, event->octave, event->degree));
+      break;
+    case CMD_SCALE_NOTE_ON:
+      {
+        double freq = tuning_freq(&song->tuning_scale, event->octave, event->degree);
+        if (freq > 0)
+          voice_note_on_freq(&voice, freq);
+        else
+          voice_note_off(&voice);
+      }
       break;
     }
     voice_advance(&voice);
@@ -1,33 +1,131 @@
 #include <string.h>
 #include <dlfcn.h>
 #include <stdio.h>
-#include <malloc.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #include "synths.h"
 #include "synthdesc.h"
 
-const struct synthdesc* finddesc(const char* name) {
-  char buffer[1024];
+static void plugin_path(char* buffer, const char* name) {
 #ifdef CYGWIN
   sprintf(buffer,"../plugins/%s.so",name);
 #else
   snprintf(buffer,1024,"../plugins/%s.so",name);
 #endif
-  void* handle = dlopen(buffer,RTLD_LAZY /* | RTLD_LOCAL not supported on CYGWIN*/);
-  if (!handle) {
+}
+
+static const struct synthdesc* opendesc(const char* path, const char* name, void** handle) {
+  *handle = dlopen(path,RTLD_LAZY /* | RTLD_LOCAL not supported on CYGWIN*/);
+  if (!*handle) {
     fprintf(stderr, "dlopen: %s\n", dlerror());
     return NULL;
   }
-  struct synthdesc* synthdesc = dlsym(handle,"synthdesc");
+  struct synthdesc* synthdesc = dlsym(*handle,"synthdesc");
   if (!synthdesc) {
-    fprintf(stderr, "shared object %s is not a plugin\n",buffer);
-    dlclose(handle);
+    fprintf(stderr, "shared object %s is not a plugin\n",name);
+    dlclose(*handle);
+    *handle = NULL;
     return NULL;
   }
   return synthdesc;
 }
 
-int synthdesc_instantiate(struct synthdesc const* synthdesc, double samplerate, void** state) {
-  *state = synthdesc->size ? malloc(synthdesc->size(samplerate)) : NULL;
+const struct synthdesc* finddesc(const char* name) {
+  char buffer[1024];
+  plugin_path(buffer,name);
+  void* handle;
+  return opendesc(buffer,buffer,&handle);
+}
+
+// copies the file to a temporary one and returns its file descriptor
+static int copy_to_temp(const char* path, char* temp_path) {
+  FILE* in = fopen(path,"rb");
+  if (!in) {
+    perror(path);
+    return -1;
+  }
+  strcpy(temp_path,"/tmp/microtracker-plugin-XXXXXX");
+  int fd = mkstemp(temp_path);
+  if (fd < 0) {
+    perror("mkstemp");
+    fclose(in);
+    return -1;
+  }
+  char buffer[65536];
+  size_t n;
+  while ((n = fread(buffer,1,sizeof(buffer),in)) > 0) {
+    if (write(fd,buffer,n) != (ssize_t)n) {
+      perror(temp_path);
+      close(fd);
+      unlink(temp_path);
+      fclose(in);
+      return -1;
+    }
+  }
+  fclose(in);
+  return fd;
+}
+
+const struct synthdesc* synthdesc_load_copy(const char* name, void** handle) {
+  char path[1024];
+  char temp_path[64];
+  plugin_path(path,name);
+  int fd = copy_to_temp(path,temp_path);
+  if (fd < 0)
+    return NULL;
+  close(fd);
+  const struct synthdesc* synthdesc = opendesc(temp_path,path,handle);
+  // the mapping stays valid after the file is gone
+  unlink(temp_path);
+  return synthdesc;
+}
+
+void synthdesc_unload(void* handle) {
+  if (handle)
+    dlclose(handle);
+}
+
+#define HUGE_PAGE_SIZE (2*1024*1024)
+
+// in front of each instance's memory, padded so the instance stays aligned
+union arenaheader {
+  size_t mapped;
+  char padding[SYNTHDESC_ALIGNMENT];
+};
+
+// maps zeroed memory with all pages faulted in, so the audio thread never
+// waits for the kernel. big arenas go on huge pages when there are any.
+static void* map_arena(size_t size, size_t* mapped) {
+  void* memory = MAP_FAILED;
+#ifdef MAP_HUGETLB
+  if (size >= HUGE_PAGE_SIZE) {
+    *mapped = (size + HUGE_PAGE_SIZE - 1) & ~(size_t)(HUGE_PAGE_SIZE - 1);
+    memory = mmap(NULL, *mapped, PROT_READ|PROT_WRITE,
+                  MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB|MAP_POPULATE, -1, 0);
+  }
+#endif
+  if (memory == MAP_FAILED) {
+    int flags = MAP_PRIVATE|MAP_ANONYMOUS;
+#ifdef MAP_POPULATE
+    flags |= MAP_POPULATE;
+#endif
+    *mapped = size;
+    memory = mmap(NULL, *mapped, PROT_READ|PROT_WRITE, flags, -1, 0);
+  }
+  return memory == MAP_FAILED ? NULL : memory;
+}
+
+int synthdesc_instantiate(struct synthdesc const* synthdesc, double samplerate, struct synthhost const* host, void** state) {
+  *state = NULL;
+  if (synthdesc->size) {
+    size_t mapped;
+    union arenaheader* header = map_arena(sizeof(union arenaheader) + synthdesc->size(samplerate), &mapped);
+    if (header) {
+      header->mapped = mapped;
+      *state = header + 1;
+    }
+  }
   if (!*state) {
     fprintf(stderr,"Failed to allocate memory for synth\n");
     return 1;
@@ -35,17 +133,36 @@ int synthdesc_instantiate(struct synthdesc const* synthdesc, double samplerate,
 
   if (synthdesc->init)
     synthdesc->init(*state, samplerate);
+  if (synthdesc->sethost && host)
+    synthdesc->sethost(*state, host);
 
   return 0;
 }
 
 void synthdesc_deinstantiate(struct synthdesc const* synthdesc, void** state) {
-  if (synthdesc) {
-    if (synthdesc->finalize) {
+  if (synthdesc && *state) {
+    if (synthdesc->finalize)
       synthdesc->finalize(*state);
-      free(*state);
-      *state = NULL;
-    }
+    union arenaheader* header = (union arenaheader*)*state - 1;
+    munmap(header, header->mapped);
+    *state = NULL;
   }
 }
 
+
+void synthdesc_paramevents(struct synthdesc const* synthdesc, void* state, int count, struct paramevent const* events) {
+  if (synthdesc->paramevents) {
+    synthdesc->paramevents(state, count, events);
+    return;
+  }
+  if (!synthdesc->params)
+    return;
+  int num_params = 0;
+  while (synthdesc->params[num_params].name)
+    num_params++;
+  for(int i=0;i<count;i++) {
+    int param = events[i].param;
+    if (param >= 0 && param < num_params && synthdesc->params[param].set)
+      synthdesc->params[param].set(state, events[i].target);
+  }
+}
@@ -1,4 +1,16 @@
+struct paramevent;
+struct synthhost;
+
 const struct synthdesc* finddesc(const char* name);
+// loads a private copy of the plugin, so that rebuilding the .so can't
+// change code that is running, and a rebuilt plugin loads as a new library.
+// *handle is for synthdesc_unload.
+const struct synthdesc* synthdesc_load_copy(const char* name, void** handle);
+void synthdesc_unload(void* handle);
 
-int synthdesc_instantiate(struct synthdesc const* synthdesc, double samplerate, void** state);
+// host may be NULL
+int synthdesc_instantiate(struct synthdesc const* synthdesc, double samplerate, struct synthhost const* host, void** state);
+// passes parameter changes to the plugin. plugins that can't ramp get
+// each parameter set to its target right away.
+void synthdesc_paramevents(struct synthdesc const* synthdesc, void* state, int count, struct paramevent const* events);
 void synthdesc_deinstantiate(struct synthdesc const* synthdesc, void** state);
@@ -0,0 +1,149 @@
+#include <unistd.h>
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include "taskpool.h"
+#include "util.h"
+
+#define TICKET_INDEX_BITS 16
+#define TICKET_INDEX_MASK ((1u << TICKET_INDEX_BITS) - 1)
+#define TICKET_CLOSED TICKET_INDEX_MASK // index no job reaches
+#define SPIN_LIMIT 2000 // polls of done before the caller goes to sleep
+
+// takes and runs indices of the current job until there are none left.
+// the compare-and-swap only succeeds while the job with the generation
+// in ticket is open, so fn, arg and count read before it belong to it.
+static void taskpool_work(struct taskpool* pool) {
+  unsigned ticket = __atomic_load_n(&pool->ticket, __ATOMIC_ACQUIRE);
+  while (1) {
+    void (*fn)(void*, int) = __atomic_load_n(&pool->fn, __ATOMIC_ACQUIRE);
+    void* arg = __atomic_load_n(&pool->arg, __ATOMIC_ACQUIRE);
+    int count = __atomic_load_n(&pool->count, __ATOMIC_ACQUIRE);
+    unsigned index = ticket & TICKET_INDEX_MASK;
+    if (index >= (unsigned)count)
+      return;
+    if (__atomic_compare_exchange_n(&pool->ticket, &ticket, ticket + 1, 0,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+      fn(arg, index);
+      if (__atomic_add_fetch(&pool->done, 1, __ATOMIC_ACQ_REL) == count)
+        sem_post(&pool->finished);
+      ticket++;
+    }
+  }
+}
+
+static void* taskpool_thread(void* arg) {
+  struct taskpool* pool = arg;
+  util_flush_denormals(); // the plugins leave that to the host
+  while (1) {
+    sem_wait(&pool->wake);
+    if (__atomic_load_n(&pool->quit, __ATOMIC_ACQUIRE))
+      break;
+    taskpool_work(pool);
+  }
+  return NULL;
+}
+
+static void host_parallel_for(struct synthhost const* host, int count, void (*fn)(void* arg, int index), void* arg) {
+  taskpool_parallel_for((struct taskpool*)host, count, fn, arg);
+}
+
+void taskpool_parallel_for(struct taskpool* pool, int count, void (*fn)(void* arg, int index), void* arg) {
+  if (count <= 1 || pool->num_threads == 0) {
+    for (int i=0;i<count;i++)
+      fn(arg, i);
+    return;
+  }
+  // close the old job under a new generation before touching its fields,
+  // so that late workers can't take indices of the new one
+  unsigned generation = (pool->ticket >> TICKET_INDEX_BITS) + 1;
+  __atomic_store_n(&pool->ticket, generation << TICKET_INDEX_BITS | TICKET_CLOSED, __ATOMIC_RELEASE);
+  int capped = count < TICKET_CLOSED ? count : TICKET_CLOSED;
+  __atomic_store_n(&pool->fn, fn, __ATOMIC_RELEASE);
+  __atomic_store_n(&pool->arg, arg, __ATOMIC_RELEASE);
+  __atomic_store_n(&pool->count, capped, __ATOMIC_RELEASE);
+  __atomic_store_n(&pool->done, 0, __ATOMIC_RELEASE);
+  __atomic_store_n(&pool->ticket, generation << TICKET_INDEX_BITS, __ATOMIC_RELEASE);
+
+  int wanted = count - 1 < pool->num_threads ? count - 1 : pool->num_threads;
+  for (int i=0;i<wanted;i++)
+    sem_post(&pool->wake);
+  taskpool_work(pool);
+  // the remaining indices are already running on workers. the last one to
+  // finish posts finished exactly once per job, and that post is taken here
+  // whether or not the spinning already saw the job through.
+  for (int spin=0;spin<SPIN_LIMIT;spin++) {
+    if (__atomic_load_n(&pool->done, __ATOMIC_ACQUIRE) == capped)
+      break;
+#if defined(__SSE2__)
+    __builtin_ia32_pause();
+#endif
+  }
+  while (sem_wait(&pool->finished) && errno == EINTR)
+    ;
+  // count may have been capped, run what didn't fit
+  for (int i=capped;i<count;i++)
+    fn(arg, i);
+}
+
+// starts a worker at SCHED_FIFO rtpriority, or with the default policy if
+// rtpriority is 0 or realtime scheduling isn't permitted
+static int taskpool_start_thread(struct taskpool* pool, pthread_t* thread, int rtpriority) {
+  if (rtpriority > 0) {
+    pthread_attr_t attr;
+    struct sched_param param = { .sched_priority = rtpriority };
+    if (!pthread_attr_init(&attr)) {
+      int error = pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED) ||
+        pthread_attr_setschedpolicy(&attr, SCHED_FIFO) ||
+        pthread_attr_setschedparam(&attr, &param) ||
+        pthread_create(thread, &attr, taskpool_thread, pool);
+      pthread_attr_destroy(&attr);
+      if (!error)
+        return 0;
+    }
+    fprintf(stderr,"Couldn't give a worker thread realtime priority %d\n",rtpriority);
+  }
+  return pthread_create(thread, NULL, taskpool_thread, pool);
+}
+
+int taskpool_init(struct taskpool* pool, int num_threads, int rtpriority) {
+  pool->host.parallel_for = host_parallel_for;
+  if (num_threads < 0)
+    num_threads = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+  if (num_threads < 0)
+    num_threads = 0;
+  if (num_threads > TASKPOOL_MAX_THREADS)
+    num_threads = TASKPOOL_MAX_THREADS;
+  pool->num_threads = 0;
+  pool->quit = 0;
+  pool->fn = NULL;
+  pool->arg = NULL;
+  pool->count = 0;
+  pool->ticket = TICKET_CLOSED;
+  pool->done = 0;
+  if (sem_init(&pool->wake, 0, 0))
+    return 1;
+  if (sem_init(&pool->finished, 0, 0)) {
+    sem_destroy(&pool->wake);
+    return 1;
+  }
+  for (int i=0;i<num_threads;i++) {
+    if (taskpool_start_thread(pool, &pool->threads[i], rtpriority)) {
+      taskpool_finalize(pool);
+      return 1;
+    }
+    pool->num_threads++;
+  }
+  return 0;
+}
+
+void taskpool_finalize(struct taskpool* pool) {
+  __atomic_store_n(&pool->quit, 1, __ATOMIC_RELEASE);
+  for (int i=0;i<pool->num_threads;i++)
+    sem_post(&pool->wake);
+  for (int i=0;i<pool->num_threads;i++)
+    pthread_join(pool->threads[i], NULL);
+  pool->num_threads = 0;
+  sem_destroy(&pool->wake);
+  sem_destroy(&pool->finished);
+}
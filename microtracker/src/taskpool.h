@@ -0,0 +1,45 @@
+#ifndef TASKPOOL_H_INCLUDED
+#define TASKPOOL_H_INCLUDED
+
+#include <pthread.h>
+#include <semaphore.h>
+#include "synthdesc.h"
+
+#define TASKPOOL_MAX_THREADS 8
+
+// Worker threads that plugins reach through struct synthhost's
+// parallel_for. The calling thread works on the job too, taking indices
+// from the same counter as the workers, so a job finishes even if no
+// worker wakes up in time. Starting a job neither locks nor allocates.
+// The workers run at the realtime priority of the thread that calls
+// parallel_for, usually the audio thread, so other load on their cores
+// can't hold up a job the caller is waiting for. Once no indices are left
+// the caller spins briefly for the ones still running on workers, then
+// sleeps on a semaphore to let them have its core.
+struct taskpool {
+  struct synthhost host; // first, so the host pointer is the pool
+
+  int num_threads;
+  pthread_t threads[TASKPOOL_MAX_THREADS];
+  sem_t wake;
+  sem_t finished; // posted by whoever finishes the last index of a job
+  int quit;
+
+  // the current job. ticket holds the job's generation in its high bits
+  // and the next index to take in its low bits.
+  void (*fn)(void* arg, int index);
+  void* arg;
+  int count;
+  unsigned ticket;
+  int done;
+};
+
+// num_threads is the number of workers besides the calling thread.
+// -1 picks one less than the number of cores. rtpriority is the SCHED_FIFO
+// priority of the threads that will call parallel_for, 0 if they aren't
+// realtime. workers fall back to normal priority if it can't be had.
+int taskpool_init(struct taskpool* pool, int num_threads, int rtpriority);
+void taskpool_finalize(struct taskpool* pool);
+void taskpool_parallel_for(struct taskpool* pool, int count, void (*fn)(void* arg, int index), void* arg);
+
+#endif
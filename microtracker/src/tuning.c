@@ -0,0 +1,302 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tuning.h"
+
+// just intervals that replace the nearest 53-EDO degree
+static double ji_multiplier_53(int degree) {
+  switch(degree) {
+  case 0: return 1.0;
+  case 7: return 35/32.0;
+  case 8: return 10.0/9.0;
+  case 9: return 9.0/8.0;
+  case 14: return 6.0/5.0;
+  case 17: return 5.0/4.0;
+  case 18: return 80.0/63.0; // 10/9 * 8/7 = 80/63
+  case 21: return 21.0/16.0;
+  case 22: return 4.0/3.0;
+  case 24: return 11.0/8.0;
+  case 25: return 25.0/18.0; // 5/3 * 5/3 * 1/2
+  case 26: return 45.0/32.0;
+  case 29: return 35.0/24.0;
+  case 31: return 3.0/2.0;
+  case 34: return 25.0/16.0;
+  case 36: return 8.0/5.0;
+  case 37: return 13.0/8.0;
+  case 39: return 5.0/3.0;
+  case 40: return 27.0/16.0;
+  case 43: return 7.0/4.0;
+  case 44: return 16.0/9.0;
+  case 45: return 9.0/5.0;
+  case 48: return 15.0/8.0;
+  case 49: return 40.0/21.0; // 5/3 * 8/7 = 40/21
+  default: return 0.0;
+  }
+}
+
+static const double major_scale[7] = { 1.0, 9.0/8.0, 5.0/4.0, 4.0/3.0, 3.0/2.0, 5.0/3.0, 15.0/8.0 };
+
+static void tuning_update_diatonic(struct tuning* tuning) {
+  int n = tuning->octave_divisions;
+  float root = tuning->freq[4][0];
+  for(int i=0;i<7;i++) {
+    int best = 0;
+    double best_distance = 1.0e9;
+    for(int degree=0; root > 0 && degree<n && degree<TUNING_DEGREES; degree++) {
+      float freq = tuning->freq[4][degree];
+      if (freq <= 0)
+        continue;
+      double distance = fabs(log2(freq / root) - log2(major_scale[i]));
+      if (distance < best_distance) {
+        best_distance = distance;
+        best = degree;
+      }
+    }
+    tuning->diatonic[i] = best;
+  }
+}
+
+void tuning_init_edo(struct tuning* tuning, int octave_divisions) {
+  if (octave_divisions < 1)
+    octave_divisions = 1;
+  tuning->octave_divisions = octave_divisions;
+  for(int i=0;i<7;i++) {
+    tuning->diatonic[i] = (int)floor(octave_divisions * log2(major_scale[i]) + 0.5);
+  }
+  for(int octave=0;octave<TUNING_OCTAVES;octave++) {
+    for(int degree=0;degree<TUNING_DEGREES;degree++) {
+      double multiplier = octave_divisions == 53 ? ji_multiplier_53(degree) : 0.0;
+      double freq;
+      if (multiplier > 0)
+        freq = pow(2.0, octave) * multiplier;
+      else
+        freq = pow(2.0, octave + (double)degree/octave_divisions);
+      tuning->freq[octave][degree] = 8 * freq;
+    }
+  }
+}
+
+struct scala_scale {
+  int size;
+  double ratio[TUNING_DEGREES + 1]; // ratio[0] is 1/1, ratio[size] the period
+};
+
+struct scala_keymap {
+  int size; // number of keys before the mapping repeats
+  int first_key;
+  int last_key;
+  int middle_key;
+  int reference_key;
+  double reference_freq;
+  int octave_degree;
+  int map[TUNING_DEGREES]; // scale degree for each key, -1 if unmapped
+};
+
+// reads the next line that is not a Scala comment
+static int scala_read_line(FILE* f, char* buffer, int size, int* line_number) {
+  while (fgets(buffer, size, f)) {
+    ++*line_number;
+    if (buffer[0] != '!')
+      return 0;
+  }
+  return 1;
+}
+
+static int scala_error(const char* filename, int line_number, const char* message) {
+  fprintf(stderr, "%s:%i: %s\n", filename, line_number, message);
+  return 1;
+}
+
+static int scala_parse_pitch(const char* text, double* ratio) {
+  char* end;
+  while (*text == ' ' || *text == '\t')
+    text++;
+  const char* dot = strchr(text, '.');
+  const char* space = strpbrk(text, " \t\r\n");
+  if (dot && (!space || dot < space)) {
+    double cents = strtod(text, &end);
+    if (end == text)
+      return 1;
+    *ratio = pow(2.0, cents / 1200.0);
+    return 0;
+  }
+  long numer = strtol(text, &end, 10);
+  if (end == text)
+    return 1;
+  long denom = 1;
+  if (*end == '/') {
+    const char* denom_text = end + 1;
+    denom = strtol(denom_text, &end, 10);
+    if (end == denom_text)
+      return 1;
+  }
+  if (numer <= 0 || denom <= 0)
+    return 1;
+  *ratio = (double)numer / denom;
+  return 0;
+}
+
+static int scala_load_scale(struct scala_scale* scale, const char* filename) {
+  FILE* f = fopen(filename, "r");
+  if (!f) {
+    fprintf(stderr, "Error: Could not open scale %s\n", filename);
+    return 1;
+  }
+  char line[256];
+  int line_number = 0;
+  int error = 0;
+  // the first line is the description
+  if (scala_read_line(f, line, sizeof(line), &line_number) ||
+      scala_read_line(f, line, sizeof(line), &line_number)) {
+    error = scala_error(filename, line_number, "unexpected end of file");
+    goto done;
+  }
+  scale->size = atoi(line);
+  if (scale->size < 1 || scale->size > TUNING_DEGREES) {
+    error = scala_error(filename, line_number, "bad number of notes");
+    goto done;
+  }
+  scale->ratio[0] = 1.0;
+  for(int i=1;i<=scale->size;i++) {
+    if (scala_read_line(f, line, sizeof(line), &line_number)) {
+      error = scala_error(filename, line_number, "fewer notes than declared");
+      goto done;
+    }
+    if (scala_parse_pitch(line, &scale->ratio[i]) || scale->ratio[i] <= 0) {
+      error = scala_error(filename, line_number, "bad pitch");
+      goto done;
+    }
+  }
+  if (scale->ratio[scale->size] <= 1.0)
+    error = scala_error(filename, line_number, "the period must be larger than 1/1");
+ done:
+  fclose(f);
+  return error;
+}
+
+static void scala_linear_keymap(struct scala_keymap* keymap, int scale_size) {
+  keymap->size = scale_size;
+  keymap->first_key = -1000000;
+  keymap->last_key = 1000000;
+  keymap->middle_key = 60;
+  keymap->reference_key = 60;
+  keymap->reference_freq = 128.0;
+  keymap->octave_degree = scale_size;
+  for(int i=0;i<scale_size;i++)
+    keymap->map[i] = i;
+}
+
+static int scala_load_keymap(struct scala_keymap* keymap, const char* filename, int scale_size) {
+  FILE* f = fopen(filename, "r");
+  if (!f) {
+    fprintf(stderr, "Error: Could not open keyboard mapping %s\n", filename);
+    return 1;
+  }
+  char line[256];
+  int line_number = 0;
+  int error = 0;
+  int header[7];
+  for(int i=0;i<7;i++) {
+    if (scala_read_line(f, line, sizeof(line), &line_number)) {
+      error = scala_error(filename, line_number, "unexpected end of file");
+      goto done;
+    }
+    if (i == 5)
+      keymap->reference_freq = atof(line);
+    else
+      header[i] = atoi(line);
+  }
+  keymap->size = header[0];
+  keymap->first_key = header[1];
+  keymap->last_key = header[2];
+  keymap->middle_key = header[3];
+  keymap->reference_key = header[4];
+  keymap->octave_degree = header[6] ? header[6] : scale_size;
+  if (keymap->octave_degree < 0) {
+    error = scala_error(filename, line_number, "bad formal octave degree");
+    goto done;
+  }
+  if (keymap->size < 0 || keymap->size > TUNING_DEGREES) {
+    error = scala_error(filename, line_number, "bad map size");
+    goto done;
+  }
+  if (keymap->reference_freq <= 0) {
+    error = scala_error(filename, line_number, "bad reference frequency");
+    goto done;
+  }
+  if (keymap->size == 0) {
+    // a linear mapping, one scale degree per key
+    keymap->size = scale_size;
+    for(int i=0;i<scale_size;i++)
+      keymap->map[i] = i;
+    goto done;
+  }
+  for(int i=0;i<keymap->size;i++) {
+    if (scala_read_line(f, line, sizeof(line), &line_number)) {
+      // missing entries at the end are unmapped
+      keymap->map[i] = -1;
+      continue;
+    }
+    char const* text = line;
+    while (*text == ' ' || *text == '\t')
+      text++;
+    if (*text == 'x' || *text == 'X')
+      keymap->map[i] = -1;
+    else if ((keymap->map[i] = atoi(text)) < 0) {
+      error = scala_error(filename, line_number, "bad scale degree");
+      goto done;
+    }
+  }
+ done:
+  fclose(f);
+  return error;
+}
+
+static double scala_degree_ratio(struct scala_scale const* scale, int degree) {
+  int periods = degree / scale->size;
+  return pow(scale->ratio[scale->size], periods) * scale->ratio[degree - periods * scale->size];
+}
+
+// frequency of key relative to the scale's 1/1 at the middle key, or 0 if unmapped
+static double scala_key_ratio(struct scala_scale const* scale, struct scala_keymap const* keymap, int key) {
+  if (key < keymap->first_key || key > keymap->last_key)
+    return 0.0;
+  int distance = key - keymap->middle_key;
+  int repeats = distance >= 0 ? distance / keymap->size : -((-distance + keymap->size - 1) / keymap->size);
+  int degree = keymap->map[distance - repeats * keymap->size];
+  if (degree < 0)
+    return 0.0;
+  double octave_ratio = scala_degree_ratio(scale, keymap->octave_degree);
+  return scala_degree_ratio(scale, degree) * pow(octave_ratio, repeats);
+}
+
+int tuning_load_scala(struct tuning* tuning, const char* scl_filename, const char* kbm_filename) {
+  struct scala_scale scale;
+  struct scala_keymap keymap;
+  if (scala_load_scale(&scale, scl_filename))
+    return 1;
+  if (kbm_filename) {
+    if (scala_load_keymap(&keymap, kbm_filename, scale.size))
+      return 1;
+  }
+  else {
+    scala_linear_keymap(&keymap, scale.size);
+  }
+  double reference_ratio = scala_key_ratio(&scale, &keymap, keymap.reference_key);
+  if (reference_ratio <= 0) {
+    fprintf(stderr, "Error: The reference key of %s is not mapped\n", kbm_filename ? kbm_filename : scl_filename);
+    return 1;
+  }
+  double base_freq = keymap.reference_freq / reference_ratio;
+
+  tuning->octave_divisions = keymap.size;
+  for(int octave=0;octave<TUNING_OCTAVES;octave++) {
+    for(int degree=0;degree<TUNING_DEGREES;degree++) {
+      int key = keymap.middle_key + (octave - 4) * keymap.size + degree;
+      tuning->freq[octave][degree] = base_freq * scala_key_ratio(&scale, &keymap, key);
+    }
+  }
+  tuning_update_diatonic(tuning);
+  return 0;
+}
@@ -0,0 +1,30 @@
+#ifndef TUNING_H_INCLUDED
+#define TUNING_H_INCLUDED
+
+#include <stdint.h>
+
+#define TUNING_OCTAVES 8
+#define TUNING_DEGREES 256
+
+// Note frequencies for every (octave, degree) an event can hold,
+// precomputed so that a note on is a single table lookup.
+struct tuning {
+  int octave_divisions;
+  uint8_t diatonic[7]; // degrees closest to the just major scale
+  float freq[TUNING_OCTAVES][TUNING_DEGREES];
+};
+
+void tuning_init_edo(struct tuning* tuning, int octave_divisions);
+
+// Builds the table from a Scala scale file and an optional Scala keyboard
+// mapping file (kbm_filename may be NULL). Octave 4, degree 0 is the
+// mapping's middle note; without a mapping it is the scale's 1/1 at 128 Hz.
+// Unmapped keys get frequency 0. Returns nonzero and leaves the tuning
+// untouched if a file cannot be read or is invalid.
+int tuning_load_scala(struct tuning* tuning, const char* scl_filename, const char* kbm_filename);
+
+static inline float tuning_freq(struct tuning const* tuning, int octave, int degree) {
+  return tuning->freq[octave < TUNING_OCTAVES ? octave : TUNING_OCTAVES - 1][degree];
+}
+
+#endif
@@ -1,3 +1,9 @@
+#include <stdint.h>
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+#include "util.h"
+
 int util_wrap(int line, int modulo) {
   while(line < 0)
     line += modulo;
@@ -6,3 +12,12 @@ int util_wrap(int line, int modulo) {
   return line;
 }
 
+void util_flush_denormals(void) {
+#if defined(__SSE__)
+  _mm_setcsr(_mm_getcsr() | 0x8040); // flush to zero, denormals are zero
+#elif defined(__aarch64__)
+  uint64_t fpcr;
+  __asm__ volatile("mrs %0, fpcr" : "=r"(fpcr));
+  __asm__ volatile("msr fpcr, %0" : : "r"(fpcr | (1 << 24)));
+#endif
+}
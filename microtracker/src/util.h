@@ -1 +1,4 @@
 int util_wrap(int line, int modulo);
+// makes the calling thread flush denormal floats to zero, so decaying
+// filters and feedback loops in the plugins don't slow down
+void util_flush_denormals(void);
@@ -15,9 +15,15 @@ static void process(void* self, int length, float const* const * in, float* cons
   }
 }
 
+static float tail(void* self) {
+  return 0;
+}
+
 struct synthdesc synthdesc = {
   .name = "2add",
   .numinputs = 4,
   .numoutputs = 2,
   .process = process,
+  .tail = tail,
+  .flags = SYNTHDESC_INPLACE,
 };
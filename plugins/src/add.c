@@ -9,9 +9,15 @@ static void process(void* self, int length, float const* const * in, float* cons
   }
 }
 
+static float tail(void* self) {
+  return 0;
+}
+
 struct synthdesc synthdesc = {
   .name = "add",
   .numinputs = 2,
   .numoutputs = 1,
   .process = process,
+  .tail = tail,
+  .flags = SYNTHDESC_INPLACE,
 };
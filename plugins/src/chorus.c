@@ -1,8 +1,8 @@
 #include "synthdesc.h"
+#include "shared/arena.h"
 
 #include <strings.h> // bzero
 #include <math.h>
-#include <malloc.h>
 #include <stdlib.h>
 
 #define MAX_DELAY 0.1 /* seconds */
@@ -22,11 +22,23 @@ struct chorus {
   double samplerate;
 };
 
+static int bufferlength(float samplerate) {
+  return (int)((MAX_DELAY+MAX_DEPTH)*samplerate)+2;
+}
+
+static int size(float samplerate) {
+  return sizeof(struct chorus) + ARENA_ALIGNMENT
+    + arena_size(bufferlength(samplerate)*2*sizeof(float));
+}
+
 static void init(void* synth, float samplerate) {
   struct chorus* const c = synth;
-  c->len = (int)((MAX_DELAY+MAX_DEPTH)*samplerate)+2;
+  struct arena arena;
+  arena_init(&arena, c, sizeof(*c), size(samplerate));
+  c->len = bufferlength(samplerate);
   c->pos = 0;
-  c->buffer = calloc(c->len*2, sizeof(float));
+  c->buffer = arena_alloc(&arena, c->len*2*sizeof(float));
+  bzero(c->buffer, c->len*2*sizeof(float));
 
   c->samplerate = samplerate;
   c->phase = 0;
@@ -39,7 +51,6 @@ static void init(void* synth, float samplerate) {
 
 static void finalize(void* synth) {
   struct chorus* const c = synth;
-  free(c->buffer);
   bzero(c,sizeof(struct chorus));
 }
 
@@ -104,8 +115,9 @@ static void process(void* synth, int length, float const * const * in, float * c
   c->phase = phase;
 }
 
-static int size(float samplerate) {
-  return sizeof(struct chorus);
+// no feedback, only the longest delay
+static float tail(void* synth) {
+  return MAX_DELAY+MAX_DEPTH;
 }
 
 struct synthdesc synthdesc = {
@@ -114,4 +126,6 @@ struct synthdesc synthdesc = {
   .init = init,
   .finalize = finalize,
   .process = process,
+  .tail = tail,
+  .flags = SYNTHDESC_INPLACE,
 };
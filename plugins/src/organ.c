@@ -1,14 +1,37 @@
 #include "shared/pipe.h"
 #include "synthdesc.h"
+#include "shared/arena.h"
+#include "shared/slaballoc.h"
 #include <assert.h>
-#include <malloc.h>
+#include <math.h>
 #include <memory.h>
 
-struct voice {
-  struct voice* next;
-  int size;
-  int key;
-  struct pipe pipe;
+#define MAX_PIPES 256 // pages of pipe memory. a page holds one low pipe or several high ones
+#define MAX_BANKS 256 // banks of LANES pipes. a pipe that finds none free stays silent
+#define NUM_BANDS 13 // half octaves of delay length up to PIPEBANK_SEGMENT
+#define MIN_FREQUENCY 16.0f // lower pipes sound an octave or more up
+#define MIN_BLOCK 256 // smallest size class of the pipe memory
+#define LANES PIPEBANK_LANES
+
+// the stops, each a rank of pipes sounding at a multiple of the key's pitch
+enum {
+  RANK_16, RANK_8, RANK_4, RANK_2_2_3, RANK_2, RANK_1_3_5, NUM_RANKS
+};
+
+static float const rankpitch[NUM_RANKS] = {
+  [RANK_16] = 0.5, [RANK_8] = 1, [RANK_4] = 2, [RANK_2_2_3] = 3, [RANK_2] = 4, [RANK_1_3_5] = 5
+};
+
+// up to LANES pipes of similar length that run together
+struct bank {
+  struct pipebank pipes;
+  int band;
+  int activeindex; // where the bank is in organ.active
+  int isopen; // whether it is in its band's list of banks with a free lane
+  struct bank* prevopen;
+  struct bank* nextopen;
+  signed char key[LANES]; // -1 once the key is up
+  signed char rank[LANES];
 };
 
 struct organ {
@@ -19,148 +42,308 @@ struct organ {
   double dckillerstate;
   double dckillercoeff;
 
-  struct voice* first_voice;
-  void* memory_start;
-  void* memory_stop;
+  int stop[NUM_RANKS]; // whether the rank is drawn
+  int keydown[128];
+  float keyfreq[128];
+  struct bank* keybank[128][NUM_RANKS]; // the pipes a held key sounds
+  signed char keylane[128][NUM_RANKS];
+
+  int num_active;
+  struct bank* active[MAX_BANKS]; // the banks with sounding pipes
+  int num_freebanks;
+  struct bank* freebanks[MAX_BANKS];
+  struct bank* open[NUM_BANDS];
+  struct bank banks[MAX_BANKS];
+  struct slaballoc alloc; // the pipes' delay lines
 };
 
+// the memory of the lowest pipe, a power of two so that every pipe fits a
+// page of the allocator
+static int pagesize(float samplerate) {
+  return slaballoc_roundup(pipe_memoryneeded(samplerate, MIN_FREQUENCY));
+}
+
+static int size(float samplerate) {
+  return sizeof(struct organ) + ARENA_ALIGNMENT + arena_size(MAX_PIPES * pagesize(samplerate));
+}
+
 void init(void* s, float samplerate) {
   struct organ* o = s;
+  struct arena arena;
+  arena_init(&arena, o, sizeof(*o), size(samplerate));
+  memset(o, 0, sizeof(*o));
   o->samplerate=samplerate;
   o->reedfactor = 0;
   o->reflectionfactor = 0.6;
   o->airfactor = 6.0;
   o->dckillerstate = 1.0e-9;
   o->dckillercoeff = 6.28*200/samplerate;
-  int memory_size = (int) (samplerate * 1) * sizeof(float);
-  o->memory_start = calloc(memory_size,1);
-  o->memory_stop = o->memory_start + memory_size;
-  o->first_voice = o->memory_stop;
+  o->stop[RANK_8] = 1;
+  o->num_freebanks = MAX_BANKS;
+  for (int i=0;i<MAX_BANKS;i++)
+    o->freebanks[i] = &o->banks[MAX_BANKS-1-i];
+  int const page = pagesize(samplerate);
+  slaballoc_init(&o->alloc, arena_alloc(&arena, MAX_PIPES * page),
+                 MAX_PIPES, page, page < MIN_BLOCK ? page : MIN_BLOCK);
 }
 
 void finalize(void* s) {
   struct organ* o = s;
-  free(o->memory_start);
   memset(o, 0, sizeof(struct organ));
 }
 
-static struct voice* find_voice(struct organ* restrict o, int key) {
-  struct voice** next_addr = &o->first_voice;
-  while(1) {
-    struct voice* next = *next_addr;
-    if ((void*)next >= o->memory_stop)
-      return NULL;
-    if (next->key == key)
-      return next;
-    next_addr = &next->next;
-  }
+// pipes of a band share banks. a bank runs in stretches as long as its
+// shortest pipe, so short pipes are kept apart from longer ones, while all
+// pipes longer than a stretch can go together.
+static int band(int delaylength) {
+  if (delaylength >= PIPEBANK_SEGMENT)
+    return NUM_BANDS-1;
+  return (int)(2*log2f(delaylength));
 }
 
-static struct voice* allocate_voice(struct organ* restrict o, float frequency) {
-  int size = sizeof(struct voice) + pipe_memoryneeded(o->samplerate,frequency);
-  size = (size + 7) & ~7; // round up to a multiple of 8
-                          // so that doubles can be are aligned properly
-  void* ptr = o->memory_start;
-  struct voice** next_addr = &o->first_voice;
-  while(1) {
-    struct voice* next = *next_addr;
-    if ((void*) next - ptr >= size) {
-      struct voice* new_voice = (struct voice*) ptr;
-      *next_addr = new_voice;
-      new_voice->next = next;
-      new_voice->size = size;
-      return new_voice;
-    }
-    if ((void*)next >= o->memory_stop) {
-      return NULL;
-    }
-    ptr = (void*)next + next->size;
-    next_addr = &next->next;
-  }
+static void openbank(struct organ* o, struct bank* b) {
+  b->prevopen = NULL;
+  b->nextopen = o->open[b->band];
+  if (b->nextopen)
+    b->nextopen->prevopen = b;
+  o->open[b->band] = b;
+  b->isopen = 1;
 }
-/*
-void free_voice(struct organ* restrict o, struct voice* voice) {
-  struct voice** next_addr = &o->first_voice;
-  while(1) {
-    struct voice* next = *next_addr;
-    if ((void*)next >= o->memory_stop) {
-      assert(0);
-      return;
-    }
-    if (next == voice) {
-      o->voice[voice->key]=NULL;
-      *next_addr = next->next;
+
+static void closebank(struct organ* o, struct bank* b) {
+  if (b->prevopen)
+    b->prevopen->nextopen = b->nextopen;
+  else
+    o->open[b->band] = b->nextopen;
+  if (b->nextopen)
+    b->nextopen->prevopen = b->prevopen;
+  b->isopen = 0;
+}
+
+// starts the pipe of a held key in a rank
+static void startpipe(struct organ* o, int key, int rank) {
+  float freq = o->keyfreq[key] * rankpitch[rank];
+  while (freq < MIN_FREQUENCY)
+    freq *= 2;
+  int const size = pipe_memoryneeded(o->samplerate,freq);
+  void* memory = slaballoc_alloc(&o->alloc, size);
+  if (memory == NULL)
+    // the pipe memory is used up, so this one stays silent
+    return;
+  // the delay line starts out silent
+  memset(memory, 0, size);
+
+  int const bandindex = band(pipe_delaylength(o->samplerate,freq));
+  struct bank* b = o->open[bandindex];
+  if (b == NULL) {
+    if (o->num_freebanks == 0) {
+      slaballoc_free(&o->alloc, memory);
       return;
     }
-    next_addr = &next->next;
+    b = o->freebanks[--o->num_freebanks];
+    pipebank_init(&b->pipes, o->samplerate);
+    b->band = bandindex;
+    b->activeindex = o->num_active;
+    o->active[o->num_active++] = b;
+    openbank(o, b);
+  }
+  int lane = 0;
+  while (b->pipes.buffer[lane])
+    lane++;
+  pipebank_setpipe(&b->pipes, lane, o->samplerate, freq,
+                   o->reflectionfactor, o->airfactor, memory);
+  pipebank_keydown(&b->pipes, lane);
+  b->key[lane] = key;
+  b->rank[lane] = rank;
+  if (b->pipes.num_used == LANES)
+    closebank(o, b);
+  o->keybank[key][rank] = b;
+  o->keylane[key][rank] = lane;
+}
+
+// lets the pipe of a key in a rank die away
+static void stoppipe(struct organ* o, int key, int rank) {
+  struct bank* b = o->keybank[key][rank];
+  if (b == NULL)
+    return;
+  int const lane = o->keylane[key][rank];
+  pipebank_keyup(&b->pipes, lane);
+  b->key[lane] = -1;
+  o->keybank[key][rank] = NULL;
+}
+
+// gives back the memory of a pipe that has gone quiet, and its bank once
+// that is empty
+static void freepipe(struct organ* o, struct bank* b, int lane) {
+  if (b->key[lane] >= 0)
+    o->keybank[b->key[lane]][b->rank[lane]] = NULL;
+  slaballoc_free(&o->alloc, b->pipes.buffer[lane]);
+  pipebank_clearpipe(&b->pipes, lane);
+  if (b->pipes.num_used > 0) {
+    if (!b->isopen)
+      openbank(o, b);
+    return;
   }
+  if (b->isopen)
+    closebank(o, b);
+  struct bank* last = o->active[--o->num_active];
+  last->activeindex = b->activeindex;
+  o->active[b->activeindex] = last;
+  o->freebanks[o->num_freebanks++] = b;
 }
-*/
-static void noteon(void* s, int voice, float freq, float velocity) {
+
+static void noteon(void* s, int key, float freq, float velocity) {
   struct organ* restrict o = s;
-  assert(0 <= voice && voice < 128);
+  assert(0 <= key && key < 128);
   assert(0 < freq);
 
-  struct voice* v = find_voice(o,voice);
-
-  if (v == NULL) {
-    freq *= 0.979;
-    v = allocate_voice(o,freq);
-    if (v == NULL)
-      // out of memory, so ignore key down event
-      return;
-    v->key = voice;
-    pipe_init(&v->pipe,o->samplerate,freq,
-              o->reedfactor,o->reflectionfactor,o->airfactor,
-              (void*)v + sizeof(struct voice));
+  if (!o->keydown[key])
+    o->keyfreq[key] = freq * 0.979;
+  o->keydown[key] = 1;
+  for (int r=0;r<NUM_RANKS;r++) {
+    if (!o->stop[r])
+      continue;
+    struct bank* b = o->keybank[key][r];
+    if (b)
+      pipebank_keydown(&b->pipes, o->keylane[key][r]);
+    else
+      startpipe(o, key, r);
   }
-  pipe_keydown(&v->pipe);
 }
 
 static void noteoff(void* s, int key) {
   struct organ* restrict o = s;
   assert(0 <= key);
   assert(key < 128);
-  struct voice* v = find_voice(o,key);
-  if (v) {
-    pipe_keyup(&v->pipe);
-    v->key = -1;
+  o->keydown[key] = 0;
+  for (int r=0;r<NUM_RANKS;r++)
+    stoppipe(o, key, r);
+}
+
+// drawing a stop sounds its rank on the keys already held, pushing it in
+// silences them
+static void setstop(struct organ* o, int rank, float value) {
+  int const drawn = value >= 0.5;
+  if (drawn == o->stop[rank])
+    return;
+  o->stop[rank] = drawn;
+  for (int key=0;key<128;key++) {
+    if (!o->keydown[key])
+      continue;
+    if (drawn)
+      startpipe(o, key, rank);
+    else
+      stoppipe(o, key, rank);
   }
 }
 
-static void process(void* s, int length, float const * const * in, float * const * out) {
-  struct organ* o = s;
-  float* outleft = out[0];
-  float* outright = out[1];
-  for (int i=0;i<length;i++) {
-    double organout = 1.0e-5;
-    struct voice** next_addr=&o->first_voice;
-    while(1) {
-      struct voice* next = *next_addr;
-      if ((void*)next >= o->memory_stop)
-        break;
-      if (!pipe_isactive(&next->pipe)) {
-        // remove voice from list
-        *next_addr = next->next;
-        memset(next,0,sizeof(struct voice));
-      }        
+// sums the pipes into pipesout, dropping the ones that have gone quiet
+static void renderblock(struct organ* o, int length, float* pipesout) {
+  for (int i=0;i<length;i++)
+    pipesout[i] = 1.0e-5;
+  // backwards, as freeing a bank moves the last one into its place
+  for (int i=o->num_active-1;i>=0;i--) {
+    struct bank* b = o->active[i];
+    pipebank_process(&b->pipes, pipesout, length);
+    for (int l=0;l<LANES;l++)
+      if (b->pipes.buffer[l] && !pipebank_isactive(&b->pipes, l))
+        freepipe(o, b, l);
+  }
+}
+
+#define RENDER_BLOCK 256 // samples the pipes run for at a time
+
+static void render(struct organ* o, int length, float * const * out, int adding) {
+  float pipesout[RENDER_BLOCK];
+  for (int offset=0;offset<length;offset+=RENDER_BLOCK) {
+    int const n = length-offset < RENDER_BLOCK ? length-offset : RENDER_BLOCK;
+    float* outleft = out[0]+offset;
+    float* outright = out[1]+offset;
+    renderblock(o, n, pipesout);
+    for (int i=0;i<n;i++) {
+      double organout = pipesout[i];
+      organout -= o->dckillerstate;
+      o->dckillerstate += organout * o->dckillercoeff;
+      organout *= 0.10;
+      if (adding) {
+        outleft[i] += organout;
+        outright[i] += organout;
+      }
       else {
-        organout += pipe_tick(&next->pipe);
-        next_addr = &next->next;
+        outleft[i] = organout;
+        outright[i] = organout;
       }
     }
-    organout -= o->dckillerstate;
-    o->dckillerstate += organout * o->dckillercoeff;
-    organout *= 0.10;
-    outleft[i] = organout;
-    outright[i] = organout;
   }
 }
 
-static int size(float samplerate) {
-  return sizeof(struct organ);
+static void process(void* s, int length, float const * const * in, float * const * out) {
+  render(s, length, out, 0);
 }
 
+static void processadding(void* s, int length, float const * const * in, float * const * out) {
+  render(s, length, out, 1);
+}
+
+static int isidle(void* s) {
+  struct organ* o = s;
+  return o->num_active == 0;
+}
+
+// whether the stop is drawn
+static float getstop(struct organ* o, int rank) {
+  return o->stop[rank];
+}
+
+static float getstop16(void* synth) {
+  return getstop(synth, RANK_16);
+}
+static float getstop8(void* synth) {
+  return getstop(synth, RANK_8);
+}
+static float getstop4(void* synth) {
+  return getstop(synth, RANK_4);
+}
+static float getstop2_2_3(void* synth) {
+  return getstop(synth, RANK_2_2_3);
+}
+static float getstop2(void* synth) {
+  return getstop(synth, RANK_2);
+}
+static float getstop1_3_5(void* synth) {
+  return getstop(synth, RANK_1_3_5);
+}
+
+static void stop16(void* synth, float value) {
+  setstop(synth, RANK_16, value);
+}
+static void stop8(void* synth, float value) {
+  setstop(synth, RANK_8, value);
+}
+static void stop4(void* synth, float value) {
+  setstop(synth, RANK_4, value);
+}
+static void stop2_2_3(void* synth, float value) {
+  setstop(synth, RANK_2_2_3, value);
+}
+static void stop2(void* synth, float value) {
+  setstop(synth, RANK_2, value);
+}
+static void stop1_3_5(void* synth, float value) {
+  setstop(synth, RANK_1_3_5, value);
+}
+
+// in the order of the RANK_ enum
+static struct paramdesc params[] = {
+  [RANK_16] = { .name = "16'", .min = 0, .max = 1, .isenum = 1, .get = getstop16, .set = stop16 },
+  [RANK_8] = { .name = "8'", .min = 0, .max = 1, .isenum = 1, .get = getstop8, .set = stop8 },
+  [RANK_4] = { .name = "4'", .min = 0, .max = 1, .isenum = 1, .get = getstop4, .set = stop4 },
+  [RANK_2_2_3] = { .name = "2 2/3'", .min = 0, .max = 1, .isenum = 1, .get = getstop2_2_3, .set = stop2_2_3 },
+  [RANK_2] = { .name = "2'", .min = 0, .max = 1, .isenum = 1, .get = getstop2, .set = stop2 },
+  [RANK_1_3_5] = { .name = "1 3/5'", .min = 0, .max = 1, .isenum = 1, .get = getstop1_3_5, .set = stop1_3_5 },
+  [NUM_RANKS] = { }
+};
+
 struct synthdesc synthdesc = {
   .name = "organ",
   .numinputs = 0,
@@ -169,6 +352,9 @@ struct synthdesc synthdesc = {
   .init = init,
   .finalize = finalize,
   .process = process,
+  .processadding = processadding,
+  .isidle = isidle,
   .noteon = noteon,
   .noteoff = noteoff,
+  .params = params,
 };
@@ -1,34 +1,54 @@
 #include "synthdesc.h"
+#include "paramramp.h"
+#include "voicepool.h"
+#include "lanemath.h"
 
 #include <strings.h> // bzero
 #include <stdlib.h>
 #include <stdint.h>
+#include <stddef.h> // offsetof
 //#include "twopole.h"
 
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 
-struct plucksynthvoice {
-  double phase0;
-  double phase1;
-  double cutoff0;
-  double cutoff1;
-  double state00;
-  double state01;
-  double state10;
-  double state11;
-  double drift;
-  double gate;
-  double phaseinc;
-  double invphaseinc;
-  double amp;
-  double smoothedamp;
-  int active;
+#define POLYPHONY 64 // plucks ring for long, so allow plenty
+
+// voice state kept one array per field, indexed by voicepool slot
+struct plucksynthvoices {
+  float phase0[POLYPHONY];
+  float phase1[POLYPHONY];
+  float cutoff0[POLYPHONY];
+  float cutoff1[POLYPHONY];
+  float state00[POLYPHONY];
+  float state01[POLYPHONY];
+  float state10[POLYPHONY];
+  float state11[POLYPHONY];
+  float drift[POLYPHONY];
+  float gate[POLYPHONY];
+  float phaseinc[POLYPHONY];
+  float invphaseinc[POLYPHONY];
+  float smoothedamp[POLYPHONY];
+  uint32_t rng_state[POLYPHONY];
+};
+
+enum {
+  PARAM_ATTACK,
+  PARAM_RELEASE,
+  PARAM_DECAYHFDAMPING0,
+  PARAM_DECAYHFDAMPING1,
+  PARAM_RELEASEHFDAMPING,
+  PARAM_RESO0,
+  PARAM_RESO1,
+  NUM_PARAMS
 };
 
+#define CONTROL_INTERVAL 16 // samples between updates while a parameter ramps
+
 struct plucksynth {
-  struct plucksynthvoice voice[128];
+  struct plucksynthvoices voices;
+  struct voicepool pool;
   double driftdepth;
   double ampattack;
   double ampdecay;
@@ -36,7 +56,6 @@ struct plucksynth {
   double whitenoiseamp; // depends on samplerate
   double noiselowpasscoeff;
   double samplerate;
-  uint32_t rng_state;
   double bend;
   double invbend;
   double cutoffscaling;
@@ -47,29 +66,46 @@ struct plucksynth {
   double releasehfdamping;
   double reso0;
   double reso1;
+  struct paramramp ramp[NUM_PARAMS];
+};
+
+// where each ramped parameter's current value lives in struct plucksynth
+static const size_t paramfields[NUM_PARAMS] = {
+  [PARAM_ATTACK] = offsetof(struct plucksynth, ampattack),
+  [PARAM_RELEASE] = offsetof(struct plucksynth, amprelease),
+  [PARAM_DECAYHFDAMPING0] = offsetof(struct plucksynth, decayhfdamping0),
+  [PARAM_DECAYHFDAMPING1] = offsetof(struct plucksynth, decayhfdamping1),
+  [PARAM_RELEASEHFDAMPING] = offsetof(struct plucksynth, releasehfdamping),
+  [PARAM_RESO0] = offsetof(struct plucksynth, reso0),
+  [PARAM_RESO1] = offsetof(struct plucksynth, reso1),
 };
 
+static double* paramfield(struct plucksynth* s, int param) {
+  return (double*)((char*)s + paramfields[param]);
+}
+
 static void init(void* synth, float samplerate) {
   struct plucksynth* const s = synth;
-  for(int i=0;i<128;i++) {
-    struct plucksynthvoice* v = &s->voice[i];
-    v->gate=0;
-    v->phaseinc=0;
-    v->invphaseinc=0;
+  struct plucksynthvoices* const v = &s->voices;
+  for(int i=0;i<POLYPHONY;i++) {
+    v->gate[i]=0;
+    v->phaseinc[i]=0;
+    v->invphaseinc[i]=0;
     // phaseinhc and invphaseinc set by retune call below.
-    v->phase0=rand()*(1.0/(RAND_MAX+1.0));
-    v->phase1=rand()*(1.0/(RAND_MAX+1.0));
-    v->drift=0;
-    v->cutoff0 = 2000;
-    v->cutoff1 = 2000;
-    v->state00 = 0;
-    v->state01 = 0;
-    v->state10 = 0;
-    v->state11 = 0;
-    v->amp=1.0e-5;
-    v->smoothedamp=v->amp;
-    v->active = 0;
+    v->phase0[i]=rand()*(1.0/(RAND_MAX+1.0));
+    v->phase1[i]=rand()*(1.0/(RAND_MAX+1.0));
+    v->drift[i]=0;
+    v->cutoff0[i] = 2000;
+    v->cutoff1[i] = 2000;
+    v->state00[i] = 0;
+    v->state01[i] = 0;
+    v->state10[i] = 0;
+    v->state11[i] = 0;
+    v->smoothedamp[i]=1.0e-5;
+    // each voice has its own noise, so the lanes don't wait on each other
+    v->rng_state[i]=i*2654435761u;
   }
+  voicepool_init(&s->pool, POLYPHONY, VOICEPOOL_STEAL_OLDEST);
   s->samplerate = samplerate;
   s->ampattack = 1000;
   s->ampdecay = 0.1;
@@ -87,156 +123,252 @@ static void init(void* synth, float samplerate) {
   s->reso0 = 0.0;
   s->reso1 = 0.0;
   s->driftdepth = 0.01;
+  for(int i=0;i<NUM_PARAMS;i++) {
+    paramramp_init(&s->ramp[i], *paramfield(s,i));
+  }
 }
 
-static void process(void* synth, int length, float const * const * in, float * const * out) {
+// what stays the same for every voice over a block
+struct blockconsts {
+  float bend;
+  float invbend;
+  float drift_ingain;
+  float drift_fbgain;
+  float driftdepth;
+  float g;
+  float cutoffscaling;
+  float decayhfdampingcoeff0;
+  float decayhfdampingcoeff1;
+  float releasehfdampingcoeff;
+  float gatedecay;
+  float ampsmoothing;
+  float reso0;
+  float reso1;
+};
+
+// renders the voices listed in pool.active from first to first+n, n <=
+// LANES, with the waveform fixed when this is inlined into one of the
+// kernels below. a voice that dies out is masked off for the rest of the
+// block.
+static inline __attribute__((always_inline))
+void renderlanes(struct plucksynth* s, struct blockconsts const* bc, int const waveform,
+                 int first, int n, int length, float* restrict outleft, float* restrict outright) {
+  struct plucksynthvoices* const v = &s->voices;
+  float const p = 1.0/2.0/3.141592;
+  float const invp = 1/p;
+  float const inv1p = 1/(1-p);
+
+  float phase0[LANES], phase1[LANES], cutoff0[LANES], cutoff1[LANES];
+  float state00[LANES], state01[LANES], state10[LANES], state11[LANES];
+  float drift[LANES], gate[LANES], phaseinc[LANES], sqrtinvphaseinc[LANES];
+  float smoothedamp[LANES], live[LANES];
+  uint32_t rng_state[LANES];
+
+  for (int l=0;l<LANES;l++) {
+    int const i = s->pool.active[first + (l < n ? l : 0)];
+    phase0[l] = v->phase0[i];
+    phase1[l] = v->phase1[i];
+    cutoff0[l] = v->cutoff0[i];
+    cutoff1[l] = v->cutoff1[i];
+    state00[l] = v->state00[i];
+    state01[l] = v->state01[i];
+    state10[l] = v->state10[i];
+    state11[l] = v->state11[i];
+    drift[l] = v->drift[i];
+    gate[l] = v->gate[i];
+    phaseinc[l] = v->phaseinc[i] * bc->bend;
+    sqrtinvphaseinc[l] = sqrtf(v->invphaseinc[i] * bc->invbend);
+    smoothedamp[l] = v->smoothedamp[i];
+    rng_state[l] = v->rng_state[i];
+    live[l] = l < n ? 0.4f : 0;
+  }
+
+  for (int j=0;j<length;j++) {
+    float out = 0;
+    for (int l=0;l<LANES;l++) {
+      float d = (int32_t)rng_state[l] * bc->drift_ingain + drift[l] * bc->drift_fbgain;
+      rng_state[l] = (rng_state[l] * 196314165u) + 907633515u;
+      drift[l] = d;
+
+      float phaseinc0 = phaseinc[l]*(0.999f+d*bc->driftdepth);
+      float phaseinc1 = phaseinc[l]*(1.001f+d*bc->driftdepth);
+
+      float ph0 = phase0[l];
+      float ph1 = phase1[l];
+      float osc0before = ph0 < p ? ph0*invp : (1-ph0)*inv1p;
+      float osc1before = ph1 < p ? ph1*invp : (1-ph1)*inv1p;
+      ph0 += phaseinc0;
+      ph1 += phaseinc1;
+      ph0 -= ph0 >= 1.0f ? 1.0f : 0;
+      ph1 -= ph1 >= 1.0f ? 1.0f : 0;
+      phase0[l] = ph0;
+      phase1[l] = ph1;
+      float osc0after = ph0 < p ? ph0*invp : (1-ph0)*inv1p;
+      float osc1after = ph1 < p ? ph1*invp : (1-ph1)*inv1p;
+
+      float osc0, osc1;
+      if (waveform == 0) {
+        osc0 = (osc0after-0.5f)*sqrtinvphaseinc[l];
+        osc1 = (osc1after-0.5f)*sqrtinvphaseinc[l];
+      }
+      else {
+        osc0 = (osc0after-osc0before)/phaseinc0*0.25f;
+        osc1 = (osc1after-osc1before)/phaseinc1*0.25f;
+      }
+
+      int const gateon = gate[l] > 0.0001f;
+      float cutoffgain0 = 1-cutoff0[l] * (gateon ? bc->decayhfdampingcoeff0 : bc->releasehfdampingcoeff);
+      float cutoffgain1 = 1-cutoff1[l] * (gateon ? bc->decayhfdampingcoeff1 : bc->releasehfdampingcoeff);
+      cutoff0[l] *= cutoffgain0 > 0.8f ? cutoffgain0 : 0.8f;
+      cutoff1[l] *= cutoffgain1 > 0.8f ? cutoffgain1 : 0.8f;
+      float c0 = cutoff0[l] * bc->cutoffscaling;
+      float c1 = cutoff1[l] * bc->cutoffscaling;
+      c0 = c0 < 0.9f ? c0 : 0.9f;
+      c1 = c1 < 0.9f ? c1 : 0.9f;
+
+      float r0 = bc->reso0*(2.0f-c0);
+      float s00 = state00[l];
+      float s01 = state01[l];
+      float feed00 = osc0 - s01*r0;
+      float feed01 = s00 + s01*r0;
+      state00[l] = s00 = s00 + c0*(feed00-s00);
+      state01[l] = s01 = s01 + c0*(feed01-s01);
+
+      float r1 = bc->reso1*(2.0f-c1);
+      float s10 = state10[l];
+      float s11 = state11[l];
+      float feed10 = osc1 - s11*r1;
+      float feed11 = s10 + s11*r1;
+      state10[l] = s10 = s10 + c1*(feed10-s10);
+      state11[l] = s11 = s11 + c1*(feed11-s11);
+
+      float osc = (s01+s11)*bc->g + 1.0e-5f;
+
+      float smoothedampdiff = gate[l]+1.0e-6f-smoothedamp[l];
+      gate[l] *= bc->gatedecay;
+      float env = smoothedamp[l] += smoothedampdiff*bc->ampsmoothing;
+
+      out += live[l] * env * osc;
+      live[l] = gate[l] < 1.0e-4f && smoothedamp[l] < 1.0e-4f ? 0 : live[l];
+    }
+    outleft[j] += out;
+    outright[j] += out;
+  }
+
+  for (int l=0;l<n;l++) {
+    int const i = s->pool.active[first + l];
+    v->phase0[i] = phase0[l];
+    v->phase1[i] = phase1[l];
+    v->cutoff0[i] = cutoff0[l];
+    v->cutoff1[i] = cutoff1[l];
+    v->state00[i] = state00[l];
+    v->state01[i] = state01[l];
+    v->state10[i] = state10[l];
+    v->state11[i] = state11[l];
+    v->drift[i] = drift[l];
+    v->gate[i] = gate[l];
+    v->smoothedamp[i] = smoothedamp[l];
+    v->rng_state[i] = rng_state[l];
+  }
+}
+
+// one kernel per waveform
+__attribute__((target_clones("avx2","default")))
+static void renderlanes_triangle(struct plucksynth* s, struct blockconsts const* bc,
+                                 int first, int n, int length, float* outleft, float* outright) {
+  renderlanes(s, bc, 0, first, n, length, outleft, outright);
+}
+__attribute__((target_clones("avx2","default")))
+static void renderlanes_slope(struct plucksynth* s, struct blockconsts const* bc,
+                              int first, int n, int length, float* outleft, float* outright) {
+  renderlanes(s, bc, 1, first, n, length, outleft, outright);
+}
+
+static void render(struct plucksynth* s, int length, float* outleft, float* outright) {
+  struct blockconsts bc;
+  bc.bend = s->bend;
+  bc.invbend = s->invbend;
+  bc.drift_ingain = s->whitenoiseamp * s->noiselowpasscoeff * (1.0/32768.0/65536.0);
+  bc.drift_fbgain = 1-s->noiselowpasscoeff;
+  bc.driftdepth = s->driftdepth;
+  float k = s->kgain;
+  if (k < 2.0)
+    k = 2.0;
+  bc.g = sqrt(1.0/k)*0.25;
+  bc.cutoffscaling = s->cutoffscaling;
+  bc.decayhfdampingcoeff0 = s->decayhfdamping0 / s->samplerate;
+  bc.decayhfdampingcoeff1 = s->decayhfdamping1 / s->samplerate;
+  bc.releasehfdampingcoeff = s->releasehfdamping / s->samplerate;
+  bc.ampsmoothing = exp(-s->ampattack/s->samplerate-0.0000001);
+  bc.gatedecay = exp(-s->ampdecay/s->samplerate-0.0000001);
+  bc.reso0 = s->reso0;
+  bc.reso1 = s->reso1;
+
+  for (int first=0;first<s->pool.num_active;first+=LANES) {
+    int n = s->pool.num_active - first;
+    if (n > LANES)
+      n = LANES;
+    if (s->waveform == 0)
+      renderlanes_triangle(s, &bc, first, n, length, outleft, outright);
+    else
+      renderlanes_slope(s, &bc, first, n, length, outleft, outright);
+  }
+
+  // give back the voices that died out
+  struct plucksynthvoices* const v = &s->voices;
+  for (int j=0;j<s->pool.num_active;) {
+    int const i = s->pool.active[j];
+    if (v->gate[i] < 1.0e-4 && v->smoothedamp[i] < 1.0e-4)
+      voicepool_release(&s->pool, i);
+    else
+      j++;
+  }
+}
+
+static int isramping(struct plucksynth* s) {
+  for(int i=0;i<NUM_PARAMS;i++) {
+    if (paramramp_isramping(&s->ramp[i]))
+      return 1;
+  }
+  return 0;
+}
+
+static void processadding(void* synth, int length, float const * const * in, float * const * out) {
   struct plucksynth* const s = synth;
   float * outleft = out[0];
   float * outright = out[1];
-  double whitenoiseamp = s->whitenoiseamp;
-  double noiselowpasscoeff = s->noiselowpasscoeff;
-  double driftdepth = s->driftdepth;
-  double drift_ingain = whitenoiseamp * noiselowpasscoeff * (1.0/32768.0/65536.0);
-  double drift_fbgain = 1-noiselowpasscoeff;
-  double bend = s->bend;
-  double invbend = s->invbend;
-  int rng_state = s->rng_state;
-  double cutoffscaling = s->cutoffscaling;
-  double kgain = s->kgain;
-  int waveform = s->waveform;
-  double decayhfdampingcoeff0 = s->decayhfdamping0 / s->samplerate;
-  double decayhfdampingcoeff1 = s->decayhfdamping1 / s->samplerate;
-  double releasehfdampingcoeff = s->releasehfdamping / s->samplerate;
-  double ampattackcoeff = 1-exp(-s->ampattack/s->samplerate-0.0000001);
-  double ampdecaycoeff = 1-exp(-s->ampdecay/s->samplerate-0.0000001);
-  double ampreleasecoeff = 1-exp(-s->amprelease/s->samplerate-0.0000001);
-  double reso0 = s->reso0;
-  double reso1 = s->reso1;
-  for(int i=0;i<length;i++) {
-    outleft[i]=1.0e-5;
-    outright[i]=1.0e-5;
-  }
-  
-  for(int i=0;i<128;i++) {
-    struct plucksynthvoice* v = &s->voice[i];
-    if(v->active) {
-      for(int j=0;j<length;j++) {
-        double oscsL = 1.0e-5;
-        double oscsR = 1.0e-5;
-        float k = kgain;
-        if (k < 2.0)
-          k = 2.0;
-        double dc = 1.0/k;
-        double g = sqrt(dc)*0.25;
-        double phaseinc = v->phaseinc * bend;
-        double const sqrtinvphaseinc = sqrt(v->invphaseinc * invbend);
-        
-        double phase0 = v->phase0;
-        double phase1 = v->phase1;
-        double drift = v->drift;
-        drift = (int)rng_state * drift_ingain + drift * drift_fbgain;
-        rng_state = (rng_state * 196314165u) + 907633515u;
-
-        double phaseinc0 = phaseinc*(0.999+drift*driftdepth);
-        double phaseinc1 = phaseinc*(1.001+drift*driftdepth);
-
-        double p = 1.0/2.0/3.141592;
- 
-        double osc0before = phase0 < p ? phase0/p : (1-phase0)/(1-p);
-        double osc1before = phase1 < p ? phase1/p : (1-phase1)/(1-p);
-
-        phase0 += phaseinc0;
-        phase1 += phaseinc1;
-
-        v->drift = drift;
-        if (phase0 >= 1.0) phase0 -= 1;
-        v->phase0 = phase0;
-        if (phase1 >= 1.0) phase1 -= 1;
-        v->phase1 = phase1;
-
-        double osc0after = phase0 < p ? phase0/p : (1-phase0)/(1-p);
-        double osc1after = phase1 < p ? phase1/p : (1-phase1)/(1-p);
-        
-        double osc0=0;
-        double osc1=0;
-        switch(waveform) {
-        case 0:
-          osc0 = (osc0after-0.5)*sqrtinvphaseinc;
-          osc1 = (osc1after-0.5)*sqrtinvphaseinc;
-          break;
-        case 1:
-          osc0 = (osc0after-osc0before)/phaseinc0*0.25;
-          osc1 = (osc1after-osc1before)/phaseinc1*0.25;
-          break;
-        };
-        
-        double cutoff0 = v->cutoff0;
-        double cutoffgain0 = 1-cutoff0 *
-          (v->gate > 0.0001 ? decayhfdampingcoeff0 : releasehfdampingcoeff);
-        if (cutoffgain0 < 0.8) {
-          cutoffgain0=0.8;
-        }
-        cutoff0 *= cutoffgain0;
-        v->cutoff0 = cutoff0;
-        double c0 = cutoff0 * cutoffscaling;
-        
-        
-        double cutoff1 = v->cutoff1;
-        double cutoffgain1 = 1-cutoff1 *
-          (v->gate > 0.0001 ? decayhfdampingcoeff1 : releasehfdampingcoeff);
-        if (cutoffgain1 < 0.8) {
-          cutoffgain1=0.8;
-        }
-        cutoff1 *= cutoffgain1;
-        v->cutoff1 = cutoff1;
-        double c1 = cutoff1 * cutoffscaling;
-        
-        if(c0 > 0.9)
-          c0 = 0.9;
-        double r0= reso0*(2.0-c0);
-        double s00 = v->state00;
-        double s01 = v->state01;
-        double feed00 = osc0 - s01*r0;
-        double feed01 = s00  + s01*r0;
-        s00 = s00 + c0*(feed00-s00);
-        s01 = s01 + c0*(feed01-s01);
-        v->state00 = s00;
-        v->state01 = s01;
-        
-        
-        if(c1 > 0.9)
-          c1 = 0.9;
-        double r1= reso1*(2.0-c1);
-        double s10 = v->state10;
-        double s11 = v->state11;
-        double feed10 = osc1 - s11*r1; // !!!! should be osc1
-        double feed11 = s10  + s11*r1;
-        s10 = s10 + c1*(feed10-s10);
-        s11 = s11 + c1*(feed11-s11);
-        v->state10 = s10;
-        v->state11 = s11;
-        
-        double osc = s01+s11;
-        
-        oscsL += osc*g;
-        oscsR += osc*g;
-        double smoothedamp = v->smoothedamp;
-        double smoothedampdiff = (v->gate+1.0e-6-smoothedamp);
-        v->gate *= 1-ampdecaycoeff;
-        double env = smoothedamp+=smoothedampdiff*(1-ampattackcoeff);
-        v->smoothedamp = smoothedamp;
-
-        env *= 0.4;
-        outleft[j] += env * oscsL;
-        outright[j] += env * oscsR;
-        if (v->gate < 1.0e-4 && smoothedamp < 1.0e-4) {
-          v->active = 0;
-          break;
-        }
+  // split the block only while some parameter is ramping
+  while (length > 0) {
+    int n = length;
+    if (isramping(s)) {
+      if (n > CONTROL_INTERVAL)
+        n = CONTROL_INTERVAL;
+      for(int i=0;i<NUM_PARAMS;i++) {
+        *paramfield(s,i) = paramramp_advance(&s->ramp[i], n);
       }
     }
-    s->rng_state = rng_state;
+    render(s, n, outleft, outright);
+    outleft += n;
+    outright += n;
+    length -= n;
+  }
+}
+
+static void paramevents(void* synth, int count, struct paramevent const* events) {
+  struct plucksynth* const s = synth;
+  for(int i=0;i<count;i++) {
+    struct paramevent const* e = &events[i];
+    if (e->param >= 0 && e->param < NUM_PARAMS)
+      paramramp_settarget(&s->ramp[e->param], e->offset, e->target, e->ramplength);
+  }
+}
+
+static void process(void* synth, int length, float const * const * in, float * const * out) {
+  for(int i=0;i<length;i++) {
+    out[0][i]=0;
+    out[1][i]=0;
   }
+  processadding(synth, length, in, out);
 }
 
 static void finalize(void* synth) {
@@ -246,20 +378,34 @@ static void finalize(void* synth) {
 
 static void noteon(void* synth, int key, float freq, float velocity) {
   struct plucksynth* const s = synth;
-  struct plucksynthvoice* const v = &s->voice[key];
-  v->phaseinc = freq/s->samplerate;
-  v->invphaseinc = 440.0/44100/v->phaseinc;
-  v->gate = sqrt(velocity);
-  v->active = 1;
-  v->cutoff0 = 12000*velocity;
-  v->cutoff1 = 12000*velocity;
+  struct plucksynthvoices* const v = &s->voices;
+  int fresh;
+  int const i = voicepool_noteon(&s->pool, key, &fresh);
+  if (i < 0)
+    return;
+  if (fresh) {
+    // the slot may hold another key's voice
+    v->state00[i] = 0;
+    v->state01[i] = 0;
+    v->state10[i] = 0;
+    v->state11[i] = 0;
+    v->drift[i] = 0;
+    v->smoothedamp[i] = 1.0e-5;
+  }
+  v->phaseinc[i] = freq/s->samplerate;
+  v->invphaseinc[i] = 440.0/44100/v->phaseinc[i];
+  v->gate[i] = sqrt(velocity);
+  v->cutoff0[i] = 12000*velocity;
+  v->cutoff1[i] = 12000*velocity;
   //  v->phase0 = 0;
   //  v->phase1 = 0;
 };
 
 static void noteoff(void* synth, int key) {
   struct plucksynth* const s = synth;
-  s->voice[key].gate=0;
+  int const i = voicepool_find(&s->pool, key);
+  if (i >= 0)
+    s->voices.gate[i]=0;
 };
 
 static void vol(void* synth, float vol) {
@@ -277,47 +423,78 @@ static void pitchbend(void* synth, float bend) {
   s->invbend = 1.0/s->bend;
 }
 
+static void setparam(struct plucksynth* s, int param, double value) {
+  paramramp_init(&s->ramp[param], value);
+  *paramfield(s,param) = value;
+}
+
+// the value the parameter is heading for
+static float getparam(struct plucksynth* s, int param) {
+  return s->ramp[param].target;
+}
+
+static float getattack(void* synth) {
+  return getparam(synth, PARAM_ATTACK);
+}
+static float getrelease(void* synth) {
+  return getparam(synth, PARAM_RELEASE);
+}
+static float getdecayhfdamping0(void* synth) {
+  return getparam(synth, PARAM_DECAYHFDAMPING0);
+}
+static float getdecayhfdamping1(void* synth) {
+  return getparam(synth, PARAM_DECAYHFDAMPING1);
+}
+static float getreleasehfdamping(void* synth) {
+  return getparam(synth, PARAM_RELEASEHFDAMPING);
+}
+static float getreso0(void* synth) {
+  return getparam(synth, PARAM_RESO0);
+}
+static float getreso1(void* synth) {
+  return getparam(synth, PARAM_RESO1);
+}
+
 static void attack(void* synth, float seconds) {
-  struct plucksynth* const s = synth;
-  s->ampattack = seconds;
+  setparam(synth, PARAM_ATTACK, seconds);
 }
 static void release(void* synth, float seconds) {
-  struct plucksynth* const s = synth;
-  s->amprelease = seconds;
+  setparam(synth, PARAM_RELEASE, seconds);
 }
 
 static void decayhfdamping0(void* synth, float decayhfdamping) {
-  struct plucksynth* s = synth;
-  s->decayhfdamping0=decayhfdamping;
+  setparam(synth, PARAM_DECAYHFDAMPING0, decayhfdamping);
 }
 static void decayhfdamping1(void* synth, float decayhfdamping) {
-  struct plucksynth* s = synth;
-  s->decayhfdamping1=decayhfdamping;
+  setparam(synth, PARAM_DECAYHFDAMPING1, decayhfdamping);
 }
 static void releasehfdamping(void* synth, float releasehfdamping) {
-  struct plucksynth* s = synth;
-  s->releasehfdamping=releasehfdamping;
+  setparam(synth, PARAM_RELEASEHFDAMPING, releasehfdamping);
 }
 static void reso0(void* synth, float reso0) {
-  struct plucksynth* s = synth;
-  s->reso0 = reso0;
+  setparam(synth, PARAM_RESO0, reso0);
 }
 static void reso1(void* synth, float reso1) {
-  struct plucksynth* s = synth;
-  s->reso1 = reso1;
+  setparam(synth, PARAM_RESO1, reso1);
 }
 
+// in the order of the PARAM_ enum
 static struct paramdesc params[] = {
-  { .name = "attack", .min = 0, .max = 10, .set = attack },
-  { .name = "release", .min = 0, .max = 10, .set = release },
-  { .name = "decayhfdamping0", .min = 0, .max = 0.1, .set = decayhfdamping0 },
-  { .name = "decayhfdamping1", .min = 0, .max = 0.1, .set = decayhfdamping1 },
-  { .name = "releasehfdamping", .min = 0, .max = 0.1, .set = releasehfdamping },
-  { .name = "reso0", .min = 0, .max = 1, .set = reso0 },
-  { .name = "reso1", .min = 0, .max = 1, .set = reso1 },
+  [PARAM_ATTACK] = { .name = "attack", .unit = "1/s", .min = 0, .max = 10000, .get = getattack, .set = attack },
+  [PARAM_RELEASE] = { .name = "release", .unit = "1/s", .min = 0, .max = 1000, .get = getrelease, .set = release },
+  [PARAM_DECAYHFDAMPING0] = { .name = "decayhfdamping0", .min = 0, .max = 0.1, .get = getdecayhfdamping0, .set = decayhfdamping0 },
+  [PARAM_DECAYHFDAMPING1] = { .name = "decayhfdamping1", .min = 0, .max = 0.1, .get = getdecayhfdamping1, .set = decayhfdamping1 },
+  [PARAM_RELEASEHFDAMPING] = { .name = "releasehfdamping", .min = 0, .max = 0.1, .get = getreleasehfdamping, .set = releasehfdamping },
+  [PARAM_RESO0] = { .name = "reso0", .min = 0, .max = 1, .get = getreso0, .set = reso0 },
+  [PARAM_RESO1] = { .name = "reso1", .min = 0, .max = 1, .get = getreso1, .set = reso1 },
   { }
 };
 
+static int isidle(void* synth) {
+  struct plucksynth* const s = synth;
+  return s->pool.num_active == 0;
+}
+
 static int size(float samplerate) {
   return sizeof(struct plucksynth);
 }
@@ -330,6 +507,9 @@ struct synthdesc synthdesc = {
   .init = init,
   .finalize = finalize,
   .process = process,
+  .processadding = processadding,
+  .paramevents = paramevents,
+  .isidle = isidle,
   .noteon = noteon,
   .noteoff = noteoff,
   .params = params,
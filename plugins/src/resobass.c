@@ -1,148 +1,267 @@
 #include "synthdesc.h"
-#include "shared/moogfilter.h"
+#include "shared/voicepool.h"
+#include "shared/blosc.h"
+#include "shared/lanemath.h"
 #include <math.h>
 
-struct voice {
-  struct moogfilter filter;
-  double hpstate1;
-  double hpstate2;
-  double hpcoeff;
-  double phase1;
-  double phaseinc;
-  double phaseinctarget;
-  double samplerate;
-  double gate;
-  double ampenv;
-  double ampenvtarget;
-  double cutoffenv;
-  double cutoffenvtarget;
-  float freqtable[128];
+#define POLYPHONY 32
+
+// voice state kept one array per field, indexed by voicepool slot
+struct voices {
+  float hpstate1[POLYPHONY];
+  float hpstate2[POLYPHONY];
+  float phase1[POLYPHONY]; // 0 to 1
+  float phaseinc[POLYPHONY];
+  float phaseinctarget[POLYPHONY];
+  float gate[POLYPHONY];
+  float ampenv[POLYPHONY];
+  float ampenvtarget[POLYPHONY];
+  float cutoffenv[POLYPHONY];
+  float cutoffenvtarget[POLYPHONY];
+  // moogfilter state
+  float p0[POLYPHONY];
+  float p1[POLYPHONY];
+  float p2[POLYPHONY];
+  float p3[POLYPHONY];
+  float p32[POLYPHONY];
+  float p33[POLYPHONY];
+  float p34[POLYPHONY];
 };
 
 struct synth {
-  struct voice voices[128];
+  struct voices voices;
+  struct voicepool pool;
   double mod;
   double reso;
   float bendcoeff;
+  // the same for every voice, worked out once in init
+  float samplerate;
+  float invsamplerate;
+  float hpcoeff;
+  float smoothing;
+  float cutoffdecay_on;
+  float cutoffdecay_off;
+  float ampdecay_on;
+  float ampdecay_off;
+  // the last phase increment of each key, which its next voice glides from
+  float keyinc[VOICEPOOL_KEYS];
 };
 
 static void init(void* synth, float samplerate) {
   struct synth* const s = synth;
-  //ms20filter_init(&s->filter);
-  for (int i = 0; i < 128; i++) {
-    struct voice* v = &s->voices[i];
-    moogfilter_init(&v->filter);
-    v->hpstate1 = 0;
-    v->hpstate2 = 0;
-    v->hpcoeff = 10.0*2*3.141592/samplerate;
-    v->phase1 = 0;
-    v->phaseinctarget = 440.0/samplerate;
-    v->phaseinc = v->phaseinctarget;
-    v->samplerate = samplerate;
-    v->gate = 0;
-    v->ampenv=0;
-    v->ampenvtarget=0;
-    v->cutoffenv=0;
-    v->cutoffenvtarget=0;
+  struct voices* const v = &s->voices;
+  for (int i = 0; i < POLYPHONY; i++) {
+    v->hpstate1[i] = 0;
+    v->hpstate2[i] = 0;
+    v->phase1[i] = 0.5;
+    v->phaseinctarget[i] = 440.0/samplerate;
+    v->phaseinc[i] = v->phaseinctarget[i];
+    v->gate[i] = 0;
+    v->ampenv[i]=0;
+    v->ampenvtarget[i]=0;
+    v->cutoffenv[i]=0;
+    v->cutoffenvtarget[i]=0;
+    v->p0[i] = v->p1[i] = v->p2[i] = v->p3[i] = 0;
+    v->p32[i] = v->p33[i] = v->p34[i] = 0;
   }
+  voicepool_init(&s->pool, POLYPHONY, VOICEPOOL_STEAL_OLDEST);
   s->mod = 0.33;
   s->reso = 0.0;
   s->bendcoeff = 1.0;
+  for (int i = 0; i < VOICEPOOL_KEYS; i++)
+    s->keyinc[i] = 440.0/samplerate;
+  s->samplerate = samplerate;
+  s->invsamplerate = 1.0/samplerate;
+  s->hpcoeff = 10.0*2*3.141592/samplerate;
+  s->smoothing = 500/samplerate;
+  s->cutoffdecay_on = 2/samplerate;
+  s->cutoffdecay_off = 16/samplerate;
+  s->ampdecay_on = 1 - 0.2/samplerate;
+  s->ampdecay_off = 1 - 4/samplerate;
 }
 
 static void finalize(void* synth) {
 }
 
-static double ticksaw(double* phase, double phaseinc) {
-  double p = *phase;
-  double v1 = p*p;
-  p += phaseinc;
-  if (p >= 0.5)
-    p -= 1.0;
-  double v2 = p*p;
-  *phase = p;
-  return (v2-v1)*(1/phaseinc);
+static int voice_isidle(struct voices const* v, int i) {
+  return v->gate[i] < 1.0e-5 &&
+    v->ampenvtarget[i] < 1.0e-5 &&
+    v->ampenv[i] < 1.0e-5;
 }
 
-static void process(void* synth, int length, float const* const* in, float * const* out) {
+static int isidle(void* synth) {
   struct synth* const s = synth;
-  float* outL = out[0];
-  float* outR = out[1];
-  
-  for(int i=0;i<length;i++) {
-    outL[i] = 0.0;
-    outR[i] = 0.0;
+  return s->pool.num_active == 0;
+}
+
+
+// renders the voices listed in pool.active from first to first+n, n <=
+// LANES, adding them to out
+__attribute__((target_clones("avx2","default")))
+static void renderlanes(struct synth* const s, int first, int n,
+                        float* outL, float* outR, int length) {
+  struct voices* const v = &s->voices;
+  float const bend = s->bendcoeff;
+  float const hpcoeff = s->hpcoeff;
+  float const smoothing = s->smoothing;
+  float const cutoffscale = s->mod*12000 * 2 * 3.141592 * s->invsamplerate;
+  float const k = s->reso*1.2*4;
+  float phase[LANES], phaseinc[LANES], phaseinctarget[LANES], invinc[LANES];
+  float hpstate1[LANES], hpstate2[LANES];
+  float cutoffenv[LANES], cutoffenvtarget[LANES], cutoffdecay[LANES];
+  float ampenv[LANES], ampenvtarget[LANES], ampdecay[LANES];
+  float p0[LANES], p1[LANES], p2[LANES], p3[LANES], p32[LANES], p33[LANES], p34[LANES];
+
+  for (int l=0;l<LANES;l++) {
+    int const i = s->pool.active[first + (l < n ? l : 0)];
+    int const gateon = v->gate[i] > 0;
+    phase[l] = v->phase1[i];
+    phaseinc[l] = v->phaseinc[i];
+    phaseinctarget[l] = v->phaseinctarget[i];
+    invinc[l] = 1 / blosc_clampinc(phaseinc[l]*bend);
+    hpstate1[l] = v->hpstate1[i];
+    hpstate2[l] = v->hpstate2[i];
+    cutoffenv[l] = v->cutoffenv[i];
+    cutoffenvtarget[l] = v->cutoffenvtarget[i];
+    cutoffdecay[l] = gateon ? s->cutoffdecay_on : s->cutoffdecay_off;
+    ampenv[l] = v->ampenv[i];
+    ampenvtarget[l] = v->ampenvtarget[i];
+    ampdecay[l] = gateon ? s->ampdecay_on : s->ampdecay_off;
+    p0[l] = v->p0[i];
+    p1[l] = v->p1[i];
+    p2[l] = v->p2[i];
+    p3[l] = v->p3[i];
+    p32[l] = v->p32[i];
+    p33[l] = v->p33[i];
+    p34[l] = v->p34[i];
   }
 
-  for (int j=0;j<128;j++) {
-    
-    struct voice* v = &s->voices[j];
-    
-    double phase1 = v->phase1;
-    double phaseinctarget = v->phaseinctarget;
-    double phaseinc = v->phaseinc;
-    double hpstate1 = v->hpstate1;
-    double hpstate2 = v->hpstate2;
-    double hpcoeff = v->hpcoeff;
-    double gate = v->gate;
-
-    if (gate < 1.0e-5 &&
-	v->ampenvtarget < 1.0e-5 &&
-	v->ampenv < 1.0e-5)
-      continue;
-
-    for(int i=0;i<length;i++) {
-      //phaseinc = phaseinctarget;
-      phaseinc += (phaseinctarget-phaseinc)*500/v->samplerate;
-      double osc =
-	ticksaw(&phase1,phaseinc*s->bendcoeff);
-      osc -= hpstate1; hpstate1 += osc*hpcoeff;
-      if (gate > 0) {
-	v->cutoffenvtarget -= 2*v->cutoffenvtarget*v->cutoffenvtarget/v->samplerate;
-      }
-      else {
-	v->cutoffenvtarget -= 16*v->cutoffenvtarget*v->cutoffenvtarget/v->samplerate;
-      }
-      v->cutoffenv += (v->cutoffenvtarget-v->cutoffenv) * 500 / v->samplerate;
-      double cutoff = v->cutoffenv * (s->mod*12000 * 2 * 3.141592 / v->samplerate);
-      osc *= 0.25;
-      double sound = moogfilter_tick(&v->filter, osc, cutoff, s->reso*1.2);
-      if (gate > 0) {
-	v->ampenvtarget *= 1 - 0.2/v->samplerate;
-      }
-      else {
-	v->ampenvtarget *= 1 - 4/v->samplerate;
-      }
-      //v->ampenv = v->ampenvtarget;
-      v->ampenv += (v->ampenvtarget-v->ampenv) * 500 / v->samplerate;
-      double g = v->ampenv;
-      sound -= hpstate2; hpstate2 += sound*hpcoeff;
-      sound = sound*g;
-      outL[i] += sound;
-      outR[i] += sound;
+  for (int i=0;i<length;i++) {
+    float sound[LANES];
+    for (int l=0;l<LANES;l++) {
+      phaseinc[l] += (phaseinctarget[l]-phaseinc[l])*smoothing;
+      float inc = blosc_clampinc(phaseinc[l]*bend);
+      invinc[l] = blosc_recip(inc, invinc[l]);
+      phase[l] = blosc_advance(phase[l], inc);
+      float osc = blosc_saw(phase[l], invinc[l]);
+      osc -= hpstate1[l]; hpstate1[l] += osc*hpcoeff;
+
+      cutoffenvtarget[l] -= cutoffdecay[l]*cutoffenvtarget[l]*cutoffenvtarget[l];
+      cutoffenv[l] += (cutoffenvtarget[l]-cutoffenv[l]) * smoothing;
+      float b = cutoffenv[l] * cutoffscale;
+      b = b > 1.0f ? 1.0f : b < 0 ? 0 : b;
+      osc *= 0.25f;
+
+      // moogfilter_tick
+      float out = p3[l] * 0.360891f + p32[l] * 0.417290f + p33[l] * 0.177896f + p34[l] * 0.0439725f;
+      p34[l] = p33[l];
+      p33[l] = p32[l];
+      p32[l] = p3[l];
+      float t0 = lanetanh(p0[l]);
+      float t1 = lanetanh(p1[l]);
+      float t2 = lanetanh(p2[l]);
+      float t3 = lanetanh(p3[l]);
+      p0[l] += (lanetanh(osc - k*out) - t0)*b;
+      float n0 = lanetanh(p0[l]);
+      p1[l] += (n0-t1)*b;
+      float n1 = lanetanh(p1[l]);
+      p2[l] += (n1-t2)*b;
+      float n2 = lanetanh(p2[l]);
+      p3[l] += (n2-t3)*b;
+
+      ampenvtarget[l] *= ampdecay[l];
+      ampenv[l] += (ampenvtarget[l]-ampenv[l]) * smoothing;
+      float snd = out - hpstate2[l]; hpstate2[l] += snd*hpcoeff;
+      sound[l] = snd*ampenv[l];
     }
-    v->phase1 = phase1;
-    v->phaseinc = phaseinc;
-    v->hpstate1 = hpstate1;
-    v->hpstate2 = hpstate2;
+    float mix = 0;
+    for (int l=0;l<n;l++)
+      mix += sound[l];
+    outL[i] += mix;
+    outR[i] += mix;
+  }
+
+  for (int l=0;l<n;l++) {
+    int const i = s->pool.active[first + l];
+    v->phase1[i] = phase[l];
+    v->phaseinc[i] = phaseinc[l];
+    v->hpstate1[i] = hpstate1[l];
+    v->hpstate2[i] = hpstate2[l];
+    v->cutoffenv[i] = cutoffenv[l];
+    v->cutoffenvtarget[i] = cutoffenvtarget[l];
+    v->ampenv[i] = ampenv[l];
+    v->ampenvtarget[i] = ampenvtarget[l];
+    v->p0[i] = p0[l];
+    v->p1[i] = p1[l];
+    v->p2[i] = p2[l];
+    v->p3[i] = p3[l];
+    v->p32[i] = p32[l];
+    v->p33[i] = p33[l];
+    v->p34[i] = p34[l];
   }
 }
+
+static void processadding(void* synth, int length, float const* const* in, float * const* out) {
+  struct synth* const s = synth;
+  for (int first=0;first<s->pool.num_active;first+=LANES) {
+    int n = s->pool.num_active - first;
+    if (n > LANES)
+      n = LANES;
+    renderlanes(s, first, n, out[0], out[1], length);
+  }
+
+  // give back the voices that died out
+  for (int j=0;j<s->pool.num_active;) {
+    int const i = s->pool.active[j];
+    if (voice_isidle(&s->voices, i))
+      voicepool_release(&s->pool, i);
+    else
+      j++;
+  }
+}
+
+static void process(void* synth, int length, float const* const* in, float * const* out) {
+  for(int i=0;i<length;i++) {
+    out[0][i] = 0.0;
+    out[1][i] = 0.0;
+  }
+  processadding(synth, length, in, out);
+}
+
 static void noteon(void* synth, int key, float freq, float velocity) {
   struct synth* const s = synth;
-  struct voice* v = &s->voices[key];
+  struct voices* v = &s->voices;
+  int fresh;
+  int const i = voicepool_noteon(&s->pool, key, &fresh);
+  if (i < 0)
+    return;
+  if (fresh) {
+    // the slot may hold another key's voice
+    v->hpstate1[i] = 0;
+    v->hpstate2[i] = 0;
+    v->phaseinc[i] = s->keyinc[key];
+    v->ampenv[i] = 0;
+    v->ampenvtarget[i] = 0;
+    v->cutoffenv[i] = 0;
+    v->cutoffenvtarget[i] = 0;
+    v->p0[i] = v->p1[i] = v->p2[i] = v->p3[i] = 0;
+    v->p32[i] = v->p33[i] = v->p34[i] = 0;
+  }
 
-  v->phaseinctarget = freq/v->samplerate;
-  v->ampenvtarget = velocity;
+  v->phaseinctarget[i] = freq*s->invsamplerate;
+  s->keyinc[key] = v->phaseinctarget[i];
+  v->ampenvtarget[i] = velocity;
   //v->ampenvtarget = sqrt(v->ampenvtarget*v->ampenvtarget+velocity*velocity);
   //v->cutoffenvtarget = sqrt(v->cutoffenvtarget*v->cutoffenvtarget+velocity*velocity);
   //v->ampenvtarget += velocity;
-  v->cutoffenvtarget = sqrt(velocity);
-  v->gate = velocity;
+  v->cutoffenvtarget[i] = sqrt(velocity);
+  v->gate[i] = velocity;
 }
 static void noteoff(void* synth, int key) {
   struct synth* const s = synth;
-  struct voice* v = &s->voices[key];
-  v->gate = 0;
+  int const i = voicepool_find(&s->pool, key);
+  if (i >= 0)
+    s->voices.gate[i] = 0;
 }
 static void vol(void* synth, float vol) {
   struct synth* const s = synth;
@@ -170,6 +289,8 @@ struct synthdesc synthdesc = {
   .init = init,
   .finalize = finalize,
   .process = process,
+  .processadding = processadding,
+  .isidle = isidle,
   .noteon = noteon,
   .noteoff = noteoff,
   .pitchbend = pitchbend,
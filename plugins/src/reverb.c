@@ -1,8 +1,8 @@
 #include "synthdesc.h"
+#include "shared/arena.h"
 
 #include <strings.h> // bzero
 #include <math.h>
-#include <malloc.h>
 #include <stdlib.h>
 
 struct reverbdelayprototype {
@@ -26,6 +26,9 @@ struct reverbdelay {
   double filterstate1R;
 };
 
+#define NUM_DELAYS 32
+#define MAX_DELAY_LENGTH 0.100 // seconds
+
 struct reverb {
   int numdelays;
   struct reverbdelay* delays;
@@ -35,15 +38,28 @@ static void reverbdelay_clear(struct reverbdelay* r) {
   bzero(r->delaystart,(r->delaystop-r->delaystart)*sizeof(float));
 }
 
+// every delay gets room for the longest length, since init picks
+// the lengths at random
+static int delaymemorysize(float samplerate) {
+  return ((int)(MAX_DELAY_LENGTH*samplerate)+2)*2*sizeof(float);
+}
+
+static int size(float samplerate) {
+  return sizeof(struct reverb) + ARENA_ALIGNMENT
+    + arena_size(NUM_DELAYS*sizeof(struct reverbdelay))
+    + NUM_DELAYS*arena_size(delaymemorysize(samplerate));
+}
+
 static void reverbdelay_init(struct reverbdelay* r,
 		      float samplerate,
 		      struct reverbdelayprototype const* prototype,
-		      float damping) {
+		      float damping,
+		      struct arena* arena) {
   int delaylength = (int)(prototype->length*samplerate+0.5);
   if (delaylength < 1)
     delaylength = 1;
   bzero(r,sizeof(*r));
-  r->delaystart = (float*)malloc(delaylength*2*sizeof(float));
+  r->delaystart = (float*)arena_alloc(arena,delaylength*2*sizeof(float));
   r->delaypos = r->delaystart;
   r->delaystop = r->delaystart + delaylength*2;
   r->gainIn = (1-prototype->feedback)*prototype->gain;
@@ -71,10 +87,12 @@ static void complexinit(struct reverb* r,
 		 struct reverbdelayprototype const* delayprototypes,
 		 float damping)
 {
+  struct arena arena;
+  arena_init(&arena,r,sizeof(*r),size(samplerate));
   r->numdelays = numdelays;
-  r->delays = (struct reverbdelay*)malloc(numdelays*sizeof(struct reverbdelay));
+  r->delays = (struct reverbdelay*)arena_alloc(&arena,numdelays*sizeof(struct reverbdelay));
   for(int i=0;i<numdelays;i++) {
-    reverbdelay_init(&r->delays[i],samplerate,&delayprototypes[i], damping);
+    reverbdelay_init(&r->delays[i],samplerate,&delayprototypes[i], damping, &arena);
   }
 }
 
@@ -82,7 +100,7 @@ static void init(void* synth, float samplerate) {
   struct reverb* r = synth;
   float twopi = 2*3.141592;
   float scale = 1.0;
-  float lengths[32] = {};
+  float lengths[NUM_DELAYS] = {};
   int numdelays = sizeof(lengths)/sizeof(lengths[0]);
   float sum=0;
   //  numdelays=6;
@@ -107,7 +125,6 @@ static void init(void* synth, float samplerate) {
 }
 
 static void reverbdelay_finalize(struct reverbdelay* r) {
-  free(r->delaystart);
   bzero(r,sizeof(*r));
 }
 
@@ -116,7 +133,6 @@ static void finalize(void* s) {
   for (int i=0;i<r->numdelays;i++) {
     reverbdelay_finalize(&r->delays[i]);
   }
-  free(r->delays);
   bzero(r,sizeof(*r));
 }
 
@@ -165,8 +181,8 @@ static void reverbdelay_process(struct reverbdelay* r,
     if(dpos >= dstop) {
       dpos = dstart;
     }
-    out0[i]+=delayOutL;
-    out1[i]+=delayOutR;
+    out0[i]+=delayOutL*0.5f;
+    out1[i]+=delayOutR*0.5f;
   }
   r->delaypos = dpos;
   r->filterstate0L = fs0L;
@@ -175,29 +191,37 @@ static void reverbdelay_process(struct reverbdelay* r,
   r->filterstate1R = fs1R;
 }
 
-static void process(void* s,int length,float const* const* in,float* const* out)
+// the delays read in while adding to out, so in and out must not be the
+// same buffers
+static void processdelays(struct reverb* r,int length,float const* const* in,float* const* out)
 {
-  struct reverb* const r = s;
-  float const* const in0=in[0];
-  float const* const in1=in[1];
-  float* const out0=out[0];
-  float* const out1=out[1];
-  for(int i=0;i<length;i++) {
-    out0[i]=in0[i]+1.0e-6;
-    out1[i]=in1[i]+1.0e-6;
-  }
   int numdelays = r->numdelays;
   for(int i=0;i<numdelays;i++) {
-    reverbdelay_process(&r->delays[i],in0,in1,out0,out1,length);
+    reverbdelay_process(&r->delays[i],in[0],in[1],out[0],out[1],length);
   }
+}
+
+static void process(void* s,int length,float const* const* in,float* const* out)
+{
   for(int i=0;i<length;i++) {
-    out0[i]=(in0[i]+out0[i])*0.5;
-    out1[i]=(in1[i]+out1[i])*0.5;
+    out[0][i]=in[0][i];
+    out[1][i]=in[1][i];
   }
+  processdelays(s,length,in,out);
 }
 
-static int size(float samplerate) {
-  return sizeof(struct reverb);
+static void processadding(void* s,int length,float const* const* in,float* const* out)
+{
+  for(int i=0;i<length;i++) {
+    out[0][i]+=in[0][i];
+    out[1][i]+=in[1][i];
+  }
+  processdelays(s,length,in,out);
+}
+
+// feedback reaches -60 dB after 3 s, -90 dB after 4.5 s, plus the longest delay
+static float tail(void* synth) {
+  return 5.0;
 }
 
 struct synthdesc synthdesc = {
@@ -208,4 +232,6 @@ struct synthdesc synthdesc = {
   .init = init,
   .finalize = finalize,
   .process = process,
+  .processadding = processadding,
+  .tail = tail,
 };
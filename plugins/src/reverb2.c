@@ -1,8 +1,8 @@
 #include "synthdesc.h"
+#include "shared/arena.h"
 
 #include <strings.h> // bzero
 #include <math.h>
-#include <malloc.h>
 #include <stdlib.h>
 
 struct reverbdelayprototype {
@@ -25,6 +25,9 @@ struct reverbdelay {
   int filterstate1R;
 };
 
+#define NUM_DELAYS 64
+#define MAX_DELAY_LENGTH 0.600 // seconds
+
 struct reverb {
   int numdelays;
   struct reverbdelay* delays;
@@ -34,15 +37,28 @@ static void reverbdelay_clear(struct reverbdelay* r) {
   bzero(r->delaystart,(r->delaystop-r->delaystart)*sizeof(float));
 }
 
+// every delay gets room for the longest length, since init picks
+// the lengths at random
+static int delaymemorysize(float samplerate) {
+  return ((int)(MAX_DELAY_LENGTH*samplerate)+2)*2*sizeof(float);
+}
+
+static int size(float samplerate) {
+  return sizeof(struct reverb) + ARENA_ALIGNMENT
+    + arena_size(NUM_DELAYS*sizeof(struct reverbdelay))
+    + NUM_DELAYS*arena_size(delaymemorysize(samplerate));
+}
+
 static void reverbdelay_init(struct reverbdelay* r,
 		      float samplerate,
 		      struct reverbdelayprototype const* prototype,
-		      float damping) {
+		      float damping,
+		      struct arena* arena) {
   int delaylength = (int)(prototype->length*samplerate+0.5);
   if (delaylength < 1)
     delaylength = 1;
   bzero(r,sizeof(*r));
-  r->delaystart = (float*)malloc(delaylength*2*sizeof(float));
+  r->delaystart = (float*)arena_alloc(arena,delaylength*2*sizeof(float));
   r->delaypos = r->delaystart;
   r->delaystop = r->delaystart + delaylength*2;
 
@@ -72,10 +88,12 @@ static void complexinit(struct reverb* r,
 		 struct reverbdelayprototype const* delayprototypes,
 		 float damping)
 {
+  struct arena arena;
+  arena_init(&arena,r,sizeof(*r),size(samplerate));
   r->numdelays = numdelays;
-  r->delays = (struct reverbdelay*)malloc(numdelays*sizeof(struct reverbdelay));
+  r->delays = (struct reverbdelay*)arena_alloc(&arena,numdelays*sizeof(struct reverbdelay));
   for(int i=0;i<numdelays;i++) {
-    reverbdelay_init(&r->delays[i],samplerate,&delayprototypes[i], damping);
+    reverbdelay_init(&r->delays[i],samplerate,&delayprototypes[i], damping, &arena);
   }
 }
 
@@ -83,7 +101,7 @@ static void init(void* synth, float samplerate) {
   struct reverb* const r = synth;
   float const twopi = 2*3.141592;
   float const scale = 1.0;
-  float lengths[64] = {};
+  float lengths[NUM_DELAYS] = {};
   int const numdelays = sizeof(lengths)/sizeof(lengths[0]);
   float sum=0;
   for(int i=0;i<numdelays;i++) {
@@ -106,7 +124,6 @@ static void init(void* synth, float samplerate) {
 }
 
 static void reverbdelay_finalize(struct reverbdelay* r) {
-  free(r->delaystart);
   bzero(r,sizeof(*r));
 }
 
@@ -115,7 +132,6 @@ static void finalize(void* synth) {
   for (int i=0;i<r->numdelays;i++) {
     reverbdelay_finalize(&r->delays[i]);
   }
-  free(r->delays);
   bzero(r,sizeof(*r));
 }
 
@@ -174,9 +190,11 @@ static void process(void* synth, int length, float const * const * in, float * c
   float const* const in1=in[1];
   float* const out0=out[0];
   float* const out1=out[1];
-  for(int i=0;i<length;i++) {
-    out0[i]=in0[i]+1.0e-6;
-    out1[i]=in1[i]+1.0e-6;
+  if (in0 != out0 || in1 != out1) {
+    for(int i=0;i<length;i++) {
+      out0[i]=in0[i];
+      out1[i]=in1[i];
+    }
   }
   int numdelays = r->numdelays;
   for(int i=0;i<numdelays;i++) {
@@ -184,8 +202,10 @@ static void process(void* synth, int length, float const * const * in, float * c
   }
 }
 
-static int size(float samplerate) {
-  return sizeof(struct reverb);
+// the delays are feedforward with -25 dB per delay on a path, so after
+// four of the longest delays everything is below -100 dB
+static float tail(void* synth) {
+  return 4*0.6;
 }
 
 struct synthdesc synthdesc = {
@@ -196,4 +216,6 @@ struct synthdesc synthdesc = {
   .init = init,
   .finalize = finalize,
   .process = process,
+  .tail = tail,
+  .flags = SYNTHDESC_INPLACE,
 };
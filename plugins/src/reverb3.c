@@ -1,8 +1,8 @@
 #include "synthdesc.h"
 #include "shared/bandpass.h"
+#include "shared/arena.h"
 #include <strings.h> // bzero
 #include <math.h>
-#include <malloc.h>
 #include <stdlib.h>
 
 #define MAX_HEADS 16
@@ -40,12 +40,23 @@ struct reverb {
   struct reverbhead heads[MAX_HEADS];
 };
 
+static int bufferlength(float samplerate) {
+  return 0.5 + 0.5 * 2 * samplerate;
+}
+
+static int size(float samplerate) {
+  return sizeof(struct reverb) + ARENA_ALIGNMENT
+    + arena_size(bufferlength(samplerate)*sizeof(double));
+}
+
 static void init(void* synth, float samplerate) {
   struct reverb* const r = synth;
   float twopi = 2*3.141592;
 
-  int length = 0.5 + 0.5 * 2 * samplerate;
-  r->bufferstart = (double*)malloc(length*sizeof(double));
+  struct arena arena;
+  arena_init(&arena,r,sizeof(*r),size(samplerate));
+  int length = bufferlength(samplerate);
+  r->bufferstart = (double*)arena_alloc(&arena,length*sizeof(double));
   r->bufferstop = r->bufferstart + length;
   bzero(r->bufferstart,length*sizeof(double));
 
@@ -94,7 +105,6 @@ static void init(void* synth, float samplerate) {
 
 static void finalize(void* synth) {
   struct reverb* const r = synth;
-  free(r->bufferstart);
   bzero(r,sizeof(*r));
 }
 
@@ -156,8 +166,9 @@ static void process(void* synth,int length,float const * const * in, float * con
   }
 }
 
-static int size(float samplerate) {
-  return sizeof(struct reverb);
+// heads decay by -60 dB in 1.5 s, -90 dB in 2.25 s, plus the buffer length
+static float tail(void* synth) {
+  return 3.5;
 }
 
 struct synthdesc synthdesc = {
@@ -168,4 +179,6 @@ struct synthdesc synthdesc = {
   .init = init,
   .finalize = finalize,
   .process = process,
+  .tail = tail,
+  .flags = SYNTHDESC_INPLACE,
 };
@@ -0,0 +1,24 @@
+#include "arena.h"
+
+#include <assert.h>
+#include <stdint.h>
+
+static char* align(char* p) {
+  return (char*)(((uintptr_t)p + ARENA_ALIGNMENT - 1) & ~(uintptr_t)(ARENA_ALIGNMENT - 1));
+}
+
+int arena_size(int size) {
+  return (size + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1);
+}
+
+void arena_init(struct arena* a, void* synth, int structsize, int total) {
+  a->next = align((char*)synth + structsize);
+  a->stop = (char*)synth + total;
+}
+
+void* arena_alloc(struct arena* a, int size) {
+  char* p = a->next;
+  a->next = align(p + size);
+  assert(a->next <= a->stop); // size() reserved too little
+  return p;
+}
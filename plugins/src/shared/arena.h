@@ -0,0 +1,20 @@
+// Hands out the memory a plugin reserved up front through size(), so that
+// init never has to allocate. size() should return
+//   sizeof(struct myplugin) + ARENA_ALIGNMENT + arena_size(a) + arena_size(b) ...
+// and init then calls arena_alloc for a, b, ... from the memory right after
+// the plugin struct. Every buffer starts on an ARENA_ALIGNMENT boundary.
+#include <stddef.h>
+
+#define ARENA_ALIGNMENT 64
+
+struct arena {
+  char* next;
+  char* stop;
+};
+
+// bytes a buffer of the given size takes up in the arena
+int arena_size(int size);
+// the arena is the memory after the plugin struct in a block of total bytes
+void arena_init(struct arena* a, void* synth, int structsize, int total);
+// the memory is not cleared
+void* arena_alloc(struct arena* a, int size);
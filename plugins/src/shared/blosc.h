@@ -0,0 +1,77 @@
+// Band-limited oscillators for the lane loops. The phase runs from 0 to 1
+// and the naive waveform is corrected over the two samples around each of
+// its jumps by a polynomial residual, polyBLEP for steps and polyBLAMP for
+// corners, which keeps most of the aliasing out for a few multiply-adds.
+// Everything is branchless and inlined, so loops over voices stay
+// vectorizable, with the phase and increment of each voice kept in the
+// synth's own per-field arrays. inc is the phase step per sample, at most
+// BLOSC_MAX_INC, and invinc its reciprocal, which blosc_recip keeps up to
+// date while inc glides.
+#include <math.h>
+
+// above half a cycle per sample the corrections around two jumps overlap
+#define BLOSC_MAX_INC 0.49f
+
+// inc limited to what the oscillators handle
+static inline float blosc_clampinc(float inc) {
+  return inc < BLOSC_MAX_INC ? inc : BLOSC_MAX_INC;
+}
+
+// the phase one sample on
+static inline float blosc_advance(float phase, float inc) {
+  phase += inc;
+  return phase >= 1.0f ? phase - 1.0f : phase;
+}
+
+// one Newton step from an earlier invinc towards 1/inc, enough to follow
+// an increment that changes a little every sample
+static inline float blosc_recip(float inc, float invinc) {
+  return invinc * (2.0f - inc*invinc);
+}
+
+// residual of a step from 1 down to -1 at phase 0, to be subtracted
+static inline float blosc_blep(float phase, float invinc) {
+  float after = 1.0f - phase*invinc;
+  float before = 1.0f + (phase-1.0f)*invinc;
+  after = after > 0 ? after : 0;
+  before = before > 0 ? before : 0;
+  return before*before - after*after;
+}
+
+// residual of a corner at phase 0 where the slope goes up by 1 per sample
+static inline float blosc_blamp(float phase, float invinc) {
+  float after = 1.0f - phase*invinc;
+  float before = 1.0f + (phase-1.0f)*invinc;
+  after = after > 0 ? after : 0;
+  before = before > 0 ? before : 0;
+  return (after*after*after + before*before*before) * (1.0f/6);
+}
+
+// the phase half a cycle on
+static inline float blosc_halfway(float phase) {
+  return phase >= 0.5f ? phase - 0.5f : phase + 0.5f;
+}
+
+// rising from -1 to 1
+static inline float blosc_saw(float phase, float invinc) {
+  return 2*phase - 1 - blosc_blep(phase, invinc);
+}
+
+// 1 for the first half of the cycle, -1 for the second
+static inline float blosc_square(float phase, float invinc) {
+  float naive = phase < 0.5f ? 1.0f : -1.0f;
+  return naive + blosc_blep(phase, invinc) - blosc_blep(blosc_halfway(phase), invinc);
+}
+
+// -1 at phase 0, 1 halfway
+static inline float blosc_triangle(float phase, float inc, float invinc) {
+  float naive = 1 - 4*fabsf(phase - 0.5f);
+  return naive + 8*inc * (blosc_blamp(phase, invinc) - blosc_blamp(blosc_halfway(phase), invinc));
+}
+
+// parabola segments meeting in a corner at phase 0, between -1/3 and 2/3
+// with no DC
+static inline float blosc_parabola(float phase, float inc, float invinc) {
+  float x = phase - 0.5f;
+  return 4*x*x - (1.0f/3) - 8*inc * blosc_blamp(phase, invinc);
+}
@@ -0,0 +1,48 @@
+// Shared by the synths that render their voices LANES at a time. A voice's
+// state lives in per-field arrays indexed by voicepool slot, and a
+// renderlanes function copies the state of up to LANES active voices into
+// local arrays, runs every sample as a loop over the lanes, which the
+// compiler turns into vector code, and writes the state back. When fewer
+// than LANES voices are left, the unused lanes repeat the first voice with
+// zero gain, so the loop has no branches. They are neither heard nor
+// written back. The renderers are built with target_clones for plain
+// x86-64 and again for AVX2, and the loader picks one when the plugin
+// loads.
+//
+// The functions below are the math those loops need. They are branchless
+// and inlined, so calling them keeps a lane loop vectorizable. See blosc.h
+// for the oscillators.
+#include <stdint.h>
+
+#define LANES 8 // one AVX2 register of floats
+
+// x*(27+x^2)/(27+9*x^2), the curve of fasttanh
+static inline float lanetanh(float x) {
+  float x2 = x*x;
+  return x*(27+x2)/(27+9*x2);
+}
+
+// 2^x, good to about 1e-7 relative
+static inline float laneexp2(float x) {
+  x = x > -126.0f ? x : -126.0f;
+  int i = (int)(x + 128.5f) - 128;
+  float f = (x - i) * 0.69314718f;
+  float p = 1 + f*(1 + f*(1.0f/2 + f*(1.0f/6 + f*(1.0f/24 + f*(1.0f/120 + f*(1.0f/720))))));
+  union { float f; int32_t i; } u = { p };
+  u.i += i << 23;
+  return u.f;
+}
+
+// log2(x) for x > 0, good to about 1e-7 relative
+static inline float lanelog2(float x) {
+  union { float f; int32_t i; } u = { x };
+  int e = (u.i >> 23) - 127;
+  u.i = (u.i & 0x007fffff) | 0x3f800000;
+  float m = u.f;
+  // keep the mantissa around 1, where the series converges fast
+  int big = m > 1.41421356f;
+  m = big ? m*0.5f : m;
+  float z = (m-1)/(m+1);
+  float z2 = z*z;
+  return (e + big) + z*(2.88539008f + z2*(0.96179669f + z2*(0.57707801f + z2*0.41219858f)));
+}
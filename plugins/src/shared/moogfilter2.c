@@ -1,5 +1,4 @@
 #include "moogfilter2.h"
-#include "fasttanh.h"
 #include <memory.h>
 #include <math.h>
 
@@ -7,7 +6,8 @@ void moogfilter2_init(struct moogfilter2* f) {
   memset(f, 0, sizeof(*f));
 }
 
-double moogfilter2_tick(struct moogfilter2* f, double IN, double omega, double reso) {
+double moogfilter2_tick(struct moogfilter2* f, double IN, double omega, double reso,
+                        double tolerance) {
   if (omega > 1.999)
     omega = 1.999;
   else if (omega < 0)
@@ -46,9 +46,11 @@ double moogfilter2_tick(struct moogfilter2* f, double IN, double omega, double r
 
   double X = Zconst / (1-ZperX);
 
-  for(int i = 0; i < 8; i++) {
-    X = tanh(Zconst + ZperX*X);
-    
+  for(int i = 0; i < MOOGFILTER2_MAX_ITERATIONS; i++) {
+    double dX = moogfilter2_newton_step(Zconst, ZperX, X);
+    X -= dX;
+    if (fabs(dX) < tolerance)
+      break;
   }
 
   double Y0 = b*X       + ib*y0;
@@ -6,5 +6,29 @@ struct moogfilter2 {
   double y3;
 };
 
+#define MOOGFILTER2_MAX_ITERATIONS 8
+#define MOOGFILTER2_TOLERANCE 1.0e-5f // default tolerance, well below audible
+
 void moogfilter2_init(struct moogfilter2* f);
-double moogfilter2_tick(struct moogfilter2* f, double in, double omega, double reso);
+// the newton solve stops once a step is smaller than tolerance, or after
+// MOOGFILTER2_MAX_ITERATIONS steps. 0 always takes all of them.
+double moogfilter2_tick(struct moogfilter2* f, double in, double omega, double reso,
+                        double tolerance);
+
+// [7/6] pade approximant of tanh, within 1e-4 of it and never beyond +-1.
+// inline, so that lane loops calling it stay vectorizable.
+static inline float moogfilter2_tanh(float x) {
+  // the approximant reaches 1 close to +-4.97
+  x = x > 4.97f ? 4.97f : x < -4.97f ? -4.97f : x;
+  float x2 = x*x;
+  return x*(135135+x2*(17325+x2*(378+x2)))/(135135+x2*(62370+x2*(3150+x2*28)));
+}
+
+// each sample the input X to the first stage solves
+// X = tanh(Zconst + ZperX*X). returns the newton-raphson step to subtract
+// from the estimate X. ZperX <= 0, so the slope is at least 1 and the step
+// is always defined.
+static inline float moogfilter2_newton_step(float Zconst, float ZperX, float X) {
+  float t = moogfilter2_tanh(Zconst + ZperX*X);
+  return (X - t) / (1 - ZperX*(1 - t*t));
+}
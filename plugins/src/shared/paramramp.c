@@ -0,0 +1,42 @@
+#include "paramramp.h"
+
+void paramramp_init(struct paramramp* r, double value) {
+  r->value = value;
+  r->target = value;
+  r->step = 0;
+  r->delay = 0;
+  r->remaining = 0;
+}
+
+void paramramp_settarget(struct paramramp* r, int offset, double target, int ramplength) {
+  if (ramplength < 1)
+    ramplength = 1;
+  r->target = target;
+  r->delay = offset;
+  r->remaining = ramplength;
+  r->step = (target - r->value) / ramplength;
+}
+
+int paramramp_isramping(struct paramramp const* r) {
+  return r->remaining > 0;
+}
+
+double paramramp_advance(struct paramramp* r, int length) {
+  if (r->remaining <= 0)
+    return r->value;
+  if (r->delay >= length) {
+    r->delay -= length;
+    return r->value;
+  }
+  length -= r->delay;
+  r->delay = 0;
+  if (length >= r->remaining) {
+    r->value = r->target;
+    r->remaining = 0;
+  }
+  else {
+    r->value += r->step * length;
+    r->remaining -= length;
+  }
+  return r->value;
+}
@@ -0,0 +1,16 @@
+// A parameter value that glides linearly to a target, for plugins that
+// take struct paramevent ramps. Starting a new ramp while one is running
+// holds the value until the new ramp's offset.
+struct paramramp {
+  double value;
+  double target;
+  double step;
+  int delay; // samples until the ramp starts moving
+  int remaining; // samples left until value reaches target
+};
+
+void paramramp_init(struct paramramp* r, double value);
+void paramramp_settarget(struct paramramp* r, int offset, double target, int ramplength);
+int paramramp_isramping(struct paramramp const* r);
+// moves the ramp length samples forward and returns the new value
+double paramramp_advance(struct paramramp* r, int length);
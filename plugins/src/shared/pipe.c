@@ -3,6 +3,7 @@
 #include "thiran.h"
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
 
 static void calcdelaylength(float samplerate, float frequency,
                             int* out_whole, float* out_frac) {
@@ -31,58 +32,13 @@ int pipe_memoryneeded(float samplerate, float frequency) {
   return delay_memoryneeded(whole);
 }
 
-void pipe_init(struct pipe *p, float samplerate, float frequency,
-	       float reedfactor, float reflectionfactor, float airfactor,
-               void* memory) {
-  int whole_length=0;
-  float frac_length=0;
-  calcdelaylength(samplerate,frequency,&whole_length,&frac_length);
-  /*
-  for(int i=0;i<4;i++) {
-    p->fir_state[i]=0;
-  }
-  lagrange4coeffs(p->fir_coeff,frac_length-1);
-  */
-  p->fd_state = 0.0;
-  p->fd_coeff = thiran1_coeff(frac_length);
-  delay_init(&p->delay,whole_length,memory);
-
-  float omega = 2*3.141592*frequency/samplerate;
-
-  onepole_init(&p->airlossfilter1, onepole_coeff_for_omega(omega*airfactor));
-  onepole_init(&p->airlossfilter2, onepole_coeff_for_omega(omega*airfactor));
-  onepole_init(&p->reflectionfilter, onepole_coeff_for_omega(omega*reflectionfactor));
-  onepole_init(&p->reedfilter, onepole_coeff_for_omega(omega*reedfactor));
-  
-  p->gain = 1.0/sqrt(frequency/440);
-  p->airflow = 1.0e-6f;
-  p->airflowtarget = 1.0e-5f;
-  p->airflowspeed = 2*3.14592 * 20 / samplerate;
-  p->silencecounter = 0;
-}
-
-void pipe_finalize(struct pipe* p) {
-  p->silencecounter=0;
-  p->gain = 0;
-  p->airflow = 0.0f;
-  p->airflowtarget = 0.0f;
-  p->airflowspeed = 0;
-  delay_finalize(&p->delay);
-  /*
-  for(int i=0;i<4;i++) {
-    p->fir_state[i] = 0;
-  }
-  for(int i=0;i<4;i++) {
-    p->fir_coeff[i] = 0;
-  }
-  */
-  onepole_finalize(&p->reflectionfilter);
-  onepole_finalize(&p->reedfilter);
-  onepole_finalize(&p->airlossfilter1);
-  onepole_finalize(&p->airlossfilter2);
+int pipe_delaylength(float samplerate, float frequency) {
+  int whole=0;
+  calcdelaylength(samplerate,frequency,&whole,NULL);
+  return whole;
 }
 
-float fastexp(float x) {
+static inline float fastexp(float x) {
   x = 1+x/128;
   x*=x;
   x*=x;
@@ -94,59 +50,175 @@ float fastexp(float x) {
   return x;
 }
 
-void pipe_keydown(struct pipe* p) {
-  p->airflowtarget = 1.0;
+#define LANES PIPEBANK_LANES
+#define SEGMENT PIPEBANK_SEGMENT
+
+void pipebank_init(struct pipebank* b, float samplerate) {
+  memset(b, 0, sizeof(*b));
+  b->airflowspeed = 2*3.14592 * 20 / samplerate;
 }
-void pipe_keyup(struct pipe* p) {
-  p->airflowtarget = 1.0e-6;
+
+static void pipebank_updateminlength(struct pipebank* b) {
+  b->minlength = SEGMENT;
+  for (int l=0;l<LANES;l++)
+    if (b->buffer[l] && b->length[l] < b->minlength)
+      b->minlength = b->length[l];
 }
-int pipe_isactive(struct pipe* p) {
-  return p->airflow > 1.0e-4 || p->airflowtarget > 1.0e-4 || p->silencecounter > 0;
+
+void pipebank_setpipe(struct pipebank* b, int lane, float samplerate, float frequency,
+                      float reflectionfactor, float airfactor, void* memory) {
+  int whole_length=0;
+  float frac_length=0;
+  calcdelaylength(samplerate,frequency,&whole_length,&frac_length);
+  float omega = 2*3.141592*frequency/samplerate;
+
+  b->buffer[lane] = memory;
+  b->length[lane] = whole_length;
+  b->pointer[lane] = 0;
+  b->silencecounter[lane] = 0;
+  b->rng_state[lane] = (uint32_t)(frequency * 1000) * 2654435761u + 1;
+  b->gain[lane] = 1.0/sqrt(frequency/440);
+  b->airflow[lane] = 1.0e-6f;
+  b->airflowtarget[lane] = 1.0e-5f;
+  b->fd_state[lane] = 0;
+  b->fd_coeff[lane] = thiran1_coeff(frac_length);
+  b->airloss1[lane] = 0;
+  b->airloss2[lane] = 0;
+  b->airlosscoeff[lane] = onepole_coeff_for_omega(omega*airfactor);
+  b->reflection[lane] = 0;
+  b->reflectioncoeff[lane] = onepole_coeff_for_omega(omega*reflectionfactor);
+  b->num_used++;
+  pipebank_updateminlength(b);
 }
 
-float pipe_tick(struct pipe* p) {
-  int silencecounter = p->silencecounter;
-  double airflow = p->airflow;
-  double const airflowtarget = p->airflowtarget;
-
-  airflow += (airflowtarget-airflow) * p->airflowspeed;
-
-  /*
-  p->fir_state[3]=p->fir_state[2];
-  p->fir_state[2]=p->fir_state[1];
-  p->fir_state[1]=p->fir_state[0];
-  p->fir_state[0]=delay_read(&p->delay);
-  
-  double const fdout
-    = 1.0e-6
-    + p->fir_state[0]*p->fir_coeff[0]
-    + p->fir_state[1]*p->fir_coeff[1]
-    + p->fir_state[2]*p->fir_coeff[2]
-    + p->fir_state[3]*p->fir_coeff[3];
-  */
-
-  double const fdout = thiran1_tick(&p->fd_state, p->fd_coeff,
-                                    delay_read(&p->delay));
-
-  double const delayout =
-    onepole_tick(&p->airlossfilter1,
-                 onepole_tick(&p->airlossfilter2,
-                              fdout));
-  
-  double const pipeout = onepole_tick(&p->reflectionfilter,delayout);
-  double const reflected = pipeout - delayout;
-  double const r = reflected-0.5;
-  
-  double const pipein = airflow * fastexp(-r*r) * (0.9+0.2*rand()/RAND_MAX);
-  double const delayin = pipein + reflected;
-  delay_write(&p->delay,delayin);
-  if(airflow > 1.0e-4 || fabs(pipeout) > 1.0e-5) {
-    silencecounter = p->delay.length*2+1;
+void pipebank_clearpipe(struct pipebank* b, int lane) {
+  // an unused lane runs along with zero state, which keeps it silent
+  b->buffer[lane] = NULL;
+  b->length[lane] = 0;
+  b->silencecounter[lane] = 0;
+  b->gain[lane] = 0;
+  b->airflow[lane] = 0;
+  b->airflowtarget[lane] = 0;
+  b->fd_state[lane] = 0;
+  b->airloss1[lane] = 0;
+  b->airloss2[lane] = 0;
+  b->reflection[lane] = 0;
+  b->num_used--;
+  pipebank_updateminlength(b);
+}
+
+void pipebank_keydown(struct pipebank* b, int lane) {
+  b->airflowtarget[lane] = 1.0;
+}
+void pipebank_keyup(struct pipebank* b, int lane) {
+  b->airflowtarget[lane] = 1.0e-6;
+}
+int pipebank_isactive(struct pipebank* b, int lane) {
+  return b->airflow[lane] > 1.0e-4 || b->airflowtarget[lane] > 1.0e-4 || b->silencecounter[lane] > 0;
+}
+
+// io holds what each lane's delay line puts out over the next n samples,
+// interleaved, and gets back what goes into them. n is at most the
+// shortest delay line, so nothing written here is read again in the same
+// call.
+static inline __attribute__((always_inline))
+void pipebank_lanes(struct pipebank* restrict b, float* restrict io, float* restrict out, int n) {
+  float const airflowspeed = b->airflowspeed;
+  float airflow[LANES], airflowtarget[LANES], fd_state[LANES], fd_coeff[LANES];
+  float air1[LANES], air2[LANES], aircoeff[LANES], refl[LANES], reflcoeff[LANES], gain[LANES];
+  int silencecounter[LANES], restart[LANES];
+  uint32_t rng_state[LANES];
+  for (int l=0;l<LANES;l++) {
+    airflow[l] = b->airflow[l];
+    airflowtarget[l] = b->airflowtarget[l];
+    fd_state[l] = b->fd_state[l];
+    fd_coeff[l] = b->fd_coeff[l];
+    air1[l] = b->airloss1[l];
+    air2[l] = b->airloss2[l];
+    aircoeff[l] = b->airlosscoeff[l];
+    refl[l] = b->reflection[l];
+    reflcoeff[l] = b->reflectioncoeff[l];
+    gain[l] = b->gain[l];
+    silencecounter[l] = b->silencecounter[l];
+    restart[l] = b->length[l]*2+1;
+    rng_state[l] = b->rng_state[l];
+  }
+
+  for (int i=0;i<n;i++) {
+    float sum = 0;
+    for (int l=0;l<LANES;l++) {
+      airflow[l] += (airflowtarget[l]-airflow[l]) * airflowspeed;
+
+      // first order thiran allpass for the fractional delay
+      float const middle = io[i*LANES+l] - fd_coeff[l] * fd_state[l];
+      float const fdout = fd_state[l] + middle * fd_coeff[l];
+      fd_state[l] = middle;
+      air2[l] += (fdout-air2[l]) * aircoeff[l];
+      air1[l] += (air2[l]-air1[l]) * aircoeff[l];
+      float const delayout = air1[l];
+      refl[l] += (delayout-refl[l]) * reflcoeff[l];
+      float const pipeout = refl[l];
+      float const reflected = pipeout - delayout;
+      float const r = reflected-0.5f;
+
+      rng_state[l] = (rng_state[l] * 196314165u) + 907633515u;
+      float const noise = (int32_t)(rng_state[l] >> 8) * (1.0f/16777216.0f);
+      float const pipein = airflow[l] * fastexp(-r*r) * (0.9f+0.2f*noise);
+      io[i*LANES+l] = pipein + reflected;
+      int const sounding = airflow[l] > 1.0e-4f || fabsf(pipeout) > 1.0e-5f;
+      silencecounter[l] = sounding ? restart[l] : silencecounter[l] - 1;
+      sum += pipeout*gain[l];
+    }
+    out[i] += sum;
+  }
+
+  for (int l=0;l<LANES;l++) {
+    b->airflow[l] = airflow[l];
+    b->fd_state[l] = fd_state[l];
+    b->airloss1[l] = air1[l];
+    b->airloss2[l] = air2[l];
+    b->reflection[l] = refl[l];
+    b->silencecounter[l] = silencecounter[l];
+    b->rng_state[l] = rng_state[l];
   }
-  else {
-    silencecounter = silencecounter - 1;
+}
+
+__attribute__((target_clones("avx2","default")))
+void pipebank_process(struct pipebank* b, float* out, int length) {
+  float io[SEGMENT*LANES] __attribute__((aligned(32)));
+  int const segment = b->minlength < SEGMENT ? b->minlength : SEGMENT;
+  for (int offset=0;offset<length;offset+=segment) {
+    int const n = length-offset < segment ? length-offset : segment;
+    // gather the delay lines' outputs into lanes
+    for (int l=0;l<LANES;l++) {
+      float const* const buffer = b->buffer[l];
+      if (!buffer) {
+        for (int i=0;i<n;i++)
+          io[i*LANES+l] = 0;
+        continue;
+      }
+      int pointer = b->pointer[l];
+      int const delaylength = b->length[l];
+      for (int i=0;i<n;i++) {
+        io[i*LANES+l] = buffer[pointer];
+        pointer = pointer+1 < delaylength ? pointer+1 : 0;
+      }
+    }
+
+    pipebank_lanes(b, io, out+offset, n);
+
+    // and put the new inputs back
+    for (int l=0;l<LANES;l++) {
+      float* const buffer = b->buffer[l];
+      if (!buffer)
+        continue;
+      int pointer = b->pointer[l];
+      int const delaylength = b->length[l];
+      for (int i=0;i<n;i++) {
+        buffer[pointer] = io[i*LANES+l];
+        pointer = pointer+1 < delaylength ? pointer+1 : 0;
+      }
+      b->pointer[l] = pointer;
+    }
   }
-  p->silencecounter = silencecounter;
-  p->airflow = airflow;
-  return pipeout*p->gain;
 }
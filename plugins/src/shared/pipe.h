@@ -1,39 +1,51 @@
 #include "delay.h"
 #include "onepole.h"
-#include "fractionaldelay.h"
-
-struct pipe {
-  int silencecounter;
-  float gain;
-  double airflow;
-  float airflowtarget;
-  float airflowspeed;
-  struct delay delay;
-  //double fir_state[4];
-  //double fir_coeff[4];
-  //struct fractionaldelay fractionaldelay;
-  double fd_state; // fractional delay state
-  double fd_coeff; // fractional delay coeff
-  struct onepole reflectionfilter;
-  struct onepole reedfilter;
-  struct onepole airlossfilter1;
-  struct onepole airlossfilter2;
-};
+#include <stdint.h>
 
 int pipe_memoryneeded(float samplerate, float frequency);
+// whole samples in the pipe's delay line
+int pipe_delaylength(float samplerate, float frequency);
 
-// memory is optional.
-// if memory is null, then the pipe will allocate and clear its own memory
-// if memory is not null, the pipe will use this memory. The memory must be
-// cleared by the caller before calling pipe_init.
-void pipe_init(struct pipe *p, float samplerate, float frequency,
-	       float reedfactor, float reflectionfactor, float airfactor,
-               void* memory);
-void pipe_finalize(struct pipe* p);
+#define PIPEBANK_LANES 8 // pipes run side by side, so the sample loop vectorizes
+#define PIPEBANK_SEGMENT 64 // most samples run between reading and writing the delay lines
+
+// PIPEBANK_LANES pipes that run together, one per lane. each pipe is a
+// delay line closed by a reflection filter and two air loss filters, and
+// is blown with noisy airflow. lanes without a pipe have no buffer and
+// stay silent. the lanes run in stretches as long as the shortest delay
+// line, up to PIPEBANK_SEGMENT samples.
+struct pipebank {
+  int num_used;
+  int minlength; // the shortest delay line of the used lanes
+  float airflowspeed;
+  float* buffer[PIPEBANK_LANES];
+  int length[PIPEBANK_LANES];
+  int pointer[PIPEBANK_LANES];
+  int silencecounter[PIPEBANK_LANES];
+  uint32_t rng_state[PIPEBANK_LANES];
+  float gain[PIPEBANK_LANES];
+  float airflow[PIPEBANK_LANES];
+  float airflowtarget[PIPEBANK_LANES];
+  float fd_state[PIPEBANK_LANES];
+  float fd_coeff[PIPEBANK_LANES];
+  float airloss1[PIPEBANK_LANES];
+  float airloss2[PIPEBANK_LANES];
+  float airlosscoeff[PIPEBANK_LANES];
+  float reflection[PIPEBANK_LANES];
+  float reflectioncoeff[PIPEBANK_LANES];
+};
 
-void pipe_keydown(struct pipe* p);
-void pipe_keyup(struct pipe* p);
+void pipebank_init(struct pipebank* b, float samplerate);
+// puts a pipe in an unused lane. memory holds pipe_memoryneeded bytes and
+// must be cleared by the caller.
+void pipebank_setpipe(struct pipebank* b, int lane, float samplerate, float frequency,
+                      float reflectionfactor, float airfactor, void* memory);
+// leaves the lane unused. its memory is the caller's again.
+void pipebank_clearpipe(struct pipebank* b, int lane);
 
-int pipe_isactive(struct pipe* p);
+void pipebank_keydown(struct pipebank* b, int lane);
+void pipebank_keyup(struct pipebank* b, int lane);
+int pipebank_isactive(struct pipebank* b, int lane);
 
-float pipe_tick(struct pipe* p);
+// runs all lanes for length samples, adding their sum to out
+void pipebank_process(struct pipebank* b, float* out, int length);
@@ -0,0 +1,86 @@
+#include "slaballoc.h"
+#include <assert.h>
+#include <stddef.h>
+
+int slaballoc_roundup(int size) {
+  int rounded = 1;
+  while (rounded < size)
+    rounded *= 2;
+  return rounded;
+}
+
+static void freelist_push(struct slabfree* head, struct slabfree* block) {
+  block->next = head->next;
+  block->prev = head;
+  head->next->prev = block;
+  head->next = block;
+}
+
+static void freelist_remove(struct slabfree* block) {
+  block->prev->next = block->next;
+  block->next->prev = block->prev;
+}
+
+void slaballoc_init(struct slaballoc* a, void* memory, int num_pages, int pagesize, int minblock) {
+  assert(num_pages <= SLABALLOC_MAX_PAGES);
+  assert(minblock >= (int)sizeof(struct slabfree));
+  a->memory = memory;
+  a->pagesize = pagesize;
+  a->minblock = minblock;
+  a->num_pages = num_pages;
+  a->num_classes = 0;
+  for (int size = minblock; size <= pagesize; size *= 2)
+    a->num_classes++;
+  assert(a->num_classes <= SLABALLOC_MAX_CLASSES);
+  for (int c = 0; c < a->num_classes; c++) {
+    a->freelist[c].next = &a->freelist[c];
+    a->freelist[c].prev = &a->freelist[c];
+  }
+  // hand out low pages first
+  a->num_freepages = num_pages;
+  for (int i = 0; i < num_pages; i++) {
+    a->freepages[i] = num_pages-1-i;
+    a->pageclass[i] = -1;
+    a->pageused[i] = 0;
+  }
+}
+
+void* slaballoc_alloc(struct slaballoc* a, int size) {
+  int c = 0;
+  while (c < a->num_classes && (a->minblock << c) < size)
+    c++;
+  if (c == a->num_classes)
+    return NULL;
+  struct slabfree* const head = &a->freelist[c];
+  if (head->next == head) {
+    // split a fresh page into blocks of this class
+    if (a->num_freepages == 0)
+      return NULL;
+    int const page = a->freepages[--a->num_freepages];
+    int const blocksize = a->minblock << c;
+    char* const start = a->memory + (size_t)page * a->pagesize;
+    for (int offset = a->pagesize - blocksize; offset >= 0; offset -= blocksize)
+      freelist_push(head, (struct slabfree*)(start + offset));
+    a->pageclass[page] = c;
+  }
+  struct slabfree* const block = head->next;
+  freelist_remove(block);
+  a->pageused[((char*)block - a->memory) / a->pagesize]++;
+  return block;
+}
+
+void slaballoc_free(struct slaballoc* a, void* block) {
+  int const page = ((char*)block - a->memory) / a->pagesize;
+  int const c = a->pageclass[page];
+  assert(c >= 0);
+  freelist_push(&a->freelist[c], block);
+  if (--a->pageused[page] > 0)
+    return;
+  // the whole page is free again, take its blocks off the class's list
+  int const blocksize = a->minblock << c;
+  char* const start = a->memory + (size_t)page * a->pagesize;
+  for (int offset = 0; offset < a->pagesize; offset += blocksize)
+    freelist_remove((struct slabfree*)(start + offset));
+  a->pageclass[page] = -1;
+  a->freepages[a->num_freepages++] = page;
+}
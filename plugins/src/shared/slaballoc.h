@@ -0,0 +1,35 @@
+// Hands out blocks of a fixed region in constant time. The region is cut
+// into pages, and a page is split into equal blocks of one size class, a
+// power of two from minblock up to the page size, when that class runs
+// out. A page goes back to the free pages as soon as all its blocks are
+// freed, so any mix of sizes up to the page size fits as long as there are
+// no more live blocks than pages.
+#define SLABALLOC_MAX_PAGES 256
+#define SLABALLOC_MAX_CLASSES 16
+
+struct slabfree {
+  struct slabfree* next;
+  struct slabfree* prev;
+};
+
+struct slaballoc {
+  char* memory;
+  int pagesize;
+  int minblock;
+  int num_pages;
+  int num_classes;
+  int num_freepages;
+  short freepages[SLABALLOC_MAX_PAGES];
+  signed char pageclass[SLABALLOC_MAX_PAGES]; // -1 while the page is free
+  short pageused[SLABALLOC_MAX_PAGES]; // blocks handed out from the page
+  struct slabfree freelist[SLABALLOC_MAX_CLASSES]; // circular, the entry is the head
+};
+
+// the smallest power of two that is at least size
+int slaballoc_roundup(int size);
+// memory holds num_pages pages of pagesize bytes. pagesize and minblock
+// are powers of two, and minblock is at least sizeof(struct slabfree).
+void slaballoc_init(struct slaballoc* a, void* memory, int num_pages, int pagesize, int minblock);
+// NULL if size is larger than a page or every page is in use
+void* slaballoc_alloc(struct slaballoc* a, int size);
+void slaballoc_free(struct slaballoc* a, void* block);
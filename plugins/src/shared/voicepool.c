@@ -0,0 +1,70 @@
+#include "voicepool.h"
+#include <assert.h>
+
+void voicepool_init(struct voicepool* p, int polyphony, enum voicepool_steal steal) {
+  assert(polyphony > 0 && polyphony <= VOICEPOOL_MAX_VOICES);
+  p->polyphony = polyphony;
+  p->steal = steal;
+  p->num_active = 0;
+  p->notes = 0;
+  for (int i=0;i<VOICEPOOL_KEYS;i++)
+    p->keyslot[i] = -1;
+  // hand out low slots first
+  p->num_free = polyphony;
+  for (int i=0;i<polyphony;i++) {
+    p->slotkey[i] = -1;
+    p->free[i] = polyphony-1-i;
+  }
+}
+
+static int voicepool_oldest(struct voicepool const* p) {
+  int oldest = p->active[0];
+  for (int i=1;i<p->num_active;i++) {
+    int const slot = p->active[i];
+    if (p->notes - p->started[slot] > p->notes - p->started[oldest])
+      oldest = slot;
+  }
+  return oldest;
+}
+
+int voicepool_noteon(struct voicepool* p, int key, int* fresh) {
+  if (key < 0 || key >= VOICEPOOL_KEYS)
+    return -1;
+  int slot = p->keyslot[key];
+  if (fresh)
+    *fresh = slot < 0;
+  if (slot < 0) {
+    if (p->num_free > 0) {
+      slot = p->free[--p->num_free];
+      p->position[slot] = p->num_active;
+      p->active[p->num_active++] = slot;
+    }
+    else if (p->steal == VOICEPOOL_STEAL_OLDEST) {
+      slot = voicepool_oldest(p);
+      p->keyslot[p->slotkey[slot]] = -1;
+    }
+    else {
+      return -1;
+    }
+    p->keyslot[key] = slot;
+    p->slotkey[slot] = key;
+  }
+  p->started[slot] = p->notes++;
+  return slot;
+}
+
+int voicepool_find(struct voicepool const* p, int key) {
+  if (key < 0 || key >= VOICEPOOL_KEYS)
+    return -1;
+  return p->keyslot[key];
+}
+
+void voicepool_release(struct voicepool* p, int slot) {
+  int const pos = p->position[slot];
+  int const last = p->active[--p->num_active];
+  p->active[pos] = last;
+  p->position[last] = pos;
+  p->keyslot[p->slotkey[slot]] = -1;
+  p->slotkey[slot] = -1;
+  p->free[p->num_free++] = slot;
+}
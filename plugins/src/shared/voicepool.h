@@ -0,0 +1,39 @@
+// Hands out a synth's voice slots to the keys that play them. The slots of
+// the sounding voices are kept in a dense list, so a synth's process only
+// looks at those instead of a slot for every key. Allocating and releasing
+// a slot take constant time. The synth keeps its own voice state in arrays
+// of polyphony entries, indexed by slot.
+#include <stddef.h>
+
+#define VOICEPOOL_KEYS 128
+#define VOICEPOOL_MAX_VOICES 128
+
+enum voicepool_steal {
+  VOICEPOOL_STEAL_NONE, // a note with no free slot isn't played
+  VOICEPOOL_STEAL_OLDEST // it takes the slot of the longest sounding voice
+};
+
+struct voicepool {
+  int polyphony;
+  enum voicepool_steal steal;
+  int num_active;
+  int num_free;
+  unsigned notes; // counts noteons, to tell which voice is oldest
+  signed char keyslot[VOICEPOOL_KEYS]; // -1 if the key has no voice
+  signed char slotkey[VOICEPOOL_MAX_VOICES]; // -1 if the slot has no key
+  unsigned char position[VOICEPOOL_MAX_VOICES]; // of an active slot in active
+  unsigned started[VOICEPOOL_MAX_VOICES];
+  unsigned char active[VOICEPOOL_MAX_VOICES]; // the first num_active are sounding
+  unsigned char free[VOICEPOOL_MAX_VOICES];
+};
+
+void voicepool_init(struct voicepool* p, int polyphony, enum voicepool_steal steal);
+// the key's slot, newly allocated unless the key is still sounding. if
+// fresh isn't NULL, *fresh tells whether the slot came from another key or
+// none. -1 if there is no slot to be had.
+int voicepool_noteon(struct voicepool* p, int key, int* fresh);
+// the key's slot, -1 if it has none
+int voicepool_find(struct voicepool const* p, int key);
+// gives the slot back once its voice has died out. the last active slot
+// moves into its place in active.
+void voicepool_release(struct voicepool* p, int slot);
@@ -0,0 +1,83 @@
+#include "wavetable.h"
+#include <math.h>
+#include <pthread.h>
+
+static float tables[WAVETABLE_SHAPES][WAVETABLE_LEVELS*WAVETABLE_STRIDE];
+static pthread_once_t tables_once = PTHREAD_ONCE_INIT;
+
+// amplitudes of harmonic k's sine and cosine
+static void harmonic(enum wavetable_shape shape, int k, double* sine, double* cosine) {
+  *sine = 0;
+  *cosine = 0;
+  switch (shape) {
+  case WAVETABLE_SINE:
+    *sine = k == 1;
+    break;
+  case WAVETABLE_TRIANGLE:
+    if (k & 1)
+      *sine = (k & 2 ? -1.0 : 1.0) / ((double)k*k);
+    break;
+  case WAVETABLE_SAW:
+    *sine = -1.0 / k;
+    break;
+  case WAVETABLE_SQUARE:
+    if (k & 1)
+      *sine = 1.0 / k;
+    break;
+  case WAVETABLE_PULSE:
+    *sine = (1 - cos(M_PI/2*k)) / k;
+    *cosine = sin(M_PI/2*k) / k;
+    break;
+  default:
+    break;
+  }
+}
+
+// adds the harmonics from the top level down, so each one is summed in
+// once and copied into every level below
+static void build(void) {
+  static double sine[WAVETABLE_SIZE];
+  double sum[WAVETABLE_SIZE];
+  for (int i=0;i<WAVETABLE_SIZE;i++)
+    sine[i] = sin(2*M_PI*i/WAVETABLE_SIZE);
+  for (int shape=0;shape<WAVETABLE_SHAPES;shape++) {
+    for (int i=0;i<WAVETABLE_SIZE;i++)
+      sum[i] = 0;
+    int k = 1;
+    for (int level=WAVETABLE_LEVELS-1;level>=0;level--) {
+      for (;k<=(WAVETABLE_SIZE/2)>>level;k++) {
+        double a, b;
+        harmonic(shape, k, &a, &b);
+        if (a == 0 && b == 0)
+          continue;
+        for (int i=0;i<WAVETABLE_SIZE;i++) {
+          int const j = (k*i) & (WAVETABLE_SIZE-1);
+          sum[i] += a*sine[j] + b*sine[(j + WAVETABLE_SIZE/4) & (WAVETABLE_SIZE-1)];
+        }
+      }
+      float* table = &tables[shape][level*WAVETABLE_STRIDE];
+      for (int i=0;i<WAVETABLE_SIZE;i++)
+        table[i] = sum[i];
+      table[WAVETABLE_SIZE] = table[0];
+    }
+    // the full band table sets the level of all of them, so a voice
+    // doesn't get louder or softer moving between levels
+    float peak = 0;
+    for (int i=0;i<WAVETABLE_SIZE;i++)
+      peak = fabsf(tables[shape][i]) > peak ? fabsf(tables[shape][i]) : peak;
+    for (int i=0;i<WAVETABLE_LEVELS*WAVETABLE_STRIDE;i++)
+      tables[shape][i] /= peak;
+  }
+}
+
+float const* wavetable_get(enum wavetable_shape shape) {
+  pthread_once(&tables_once, build);
+  return tables[shape];
+}
+
+int wavetable_level(float inc) {
+  int level = 0;
+  while (level < WAVETABLE_LEVELS-1 && ((WAVETABLE_SIZE/2)>>level) * inc > 0.5f)
+    level++;
+  return level;
+}
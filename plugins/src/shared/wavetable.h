@@ -0,0 +1,26 @@
+// Band-limited single cycle waveforms for wavetable oscillators, as mipmaps
+// of one table per octave. Level m holds the first WAVETABLE_SIZE/2 >> m
+// harmonics, so a voice reading the level wavetable_level picks for its
+// pitch never goes past Nyquist. The tables are built the first time any
+// instance asks for them and are read only from then on, so all
+// instances of all plugins in the process share one copy.
+
+#define WAVETABLE_BITS 11
+#define WAVETABLE_SIZE (1<<WAVETABLE_BITS)
+#define WAVETABLE_STRIDE (WAVETABLE_SIZE+1) // a guard sample for interpolation
+#define WAVETABLE_LEVELS (WAVETABLE_BITS) // down to the fundamental alone
+
+enum wavetable_shape {
+  WAVETABLE_SINE,
+  WAVETABLE_TRIANGLE,
+  WAVETABLE_SAW,
+  WAVETABLE_SQUARE,
+  WAVETABLE_PULSE, // a quarter of the cycle high
+  WAVETABLE_SHAPES
+};
+
+// WAVETABLE_LEVELS tables of WAVETABLE_STRIDE samples for the shape, one
+// after the other, peaking at about 1. safe to call from several threads.
+float const* wavetable_get(enum wavetable_shape shape);
+// the level for a phase increment in cycles per sample
+int wavetable_level(float inc);
@@ -1,7 +1,8 @@
 #include "synthdesc.h"
-#include "shared/onepole.h"
-#include "shared/moogfilter.h"
-#include "shared/fasttanh.h"
+#include "shared/paramramp.h"
+#include "shared/voicepool.h"
+#include "shared/blosc.h"
+#include "shared/lanemath.h"
 #include <strings.h> // bzero
 #include <stdlib.h>
 #include <math.h>
@@ -15,26 +16,32 @@
 #define CUTOFF 4000
 #define DC_GAIN 0.5
 
+// the envelope releases towards this rather than to 0, and a voice is
+// done once it is within a margin of it
+#define ENV_FLOOR 1.0e-6f
+
 #define GAIN_TRACKING 0.20
 #define CUTOFF_TRACKING 0.7
 
-struct voice {
-  struct moogfilter filter;
-  double lpstate1;
-  double lpstate2;
-  double phase1;
-  double drift1;
-  double gate;
-  double freq;
-  double cutoff;
-  double smoothedfreq;
-  double smoothedcutoff;
-  double smoothedamp;
-  int active;
+#define POLYPHONY 32
+
+// voice state kept one array per field, indexed by voicepool slot
+struct voices {
+  float lpstate1[POLYPHONY];
+  float lpstate2[POLYPHONY];
+  float phase1[POLYPHONY];
+  float drift1[POLYPHONY];
+  float gate[POLYPHONY];
+  float freq[POLYPHONY];
+  float cutoff[POLYPHONY];
+  float smoothedfreq[POLYPHONY];
+  float smoothedamp[POLYPHONY];
+  uint32_t rng_state[POLYPHONY];
 };
 
 struct synth {
-  struct voice voice[128];
+  struct voices voices;
+  struct voicepool pool;
   double driftdepth;
   double ampattack;
   double amprelease;
@@ -44,31 +51,36 @@ struct synth {
   double whitenoiseamp; // depends on samplerate
   double noiselowpasscoeff;
   double samplerate;
-  uint32_t rng_state;
   double bend;
   double invbend;
   double mod;
   double resonance;
   double dcfollower;
   int vcftype;
+  struct paramramp attackramp;
+  struct paramramp releaseramp;
+  // the last pitch of each key, which its next voice glides from
+  float keyfreq[VOICEPOOL_KEYS];
 };
 
 static void init(void* synth, float samplerate) {
   struct synth* s = synth;
+  struct voices* v = &s->voices;
   int i;
-  for(i=0;i<128;i++) {
-    struct voice* v = &s->voice[i];
-    moogfilter_init(&v->filter);
-    v->phase1=-0.5+rand()*(1.0/(RAND_MAX+1.0));
-    v->drift1=0;
-    v->freq=220;
-    v->cutoff=CUTOFF;
-    v->smoothedfreq=220;
-    v->smoothedcutoff=v->cutoff;
-    v->gate=0;
-    v->smoothedamp=1.0e-5;
-    v->active=0;
+  for(i=0;i<POLYPHONY;i++) {
+    v->phase1[i]=rand()*(1.0/(RAND_MAX+1.0));
+    v->drift1[i]=0;
+    v->freq[i]=220;
+    v->cutoff[i]=CUTOFF;
+    v->smoothedfreq[i]=220;
+    v->gate[i]=0;
+    v->smoothedamp[i]=1.0e-5;
+    // each voice has its own noise, so the lanes don't wait on each other
+    v->rng_state[i]=i*2654435761u;
   }
+  voicepool_init(&s->pool, POLYPHONY, VOICEPOOL_STEAL_OLDEST);
+  for(i=0;i<VOICEPOOL_KEYS;i++)
+    s->keyfreq[i]=220;
   s->samplerate = samplerate;
   s->ampattack = 0.003;
   s->amprelease = 0.010;
@@ -82,16 +94,104 @@ static void init(void* synth, float samplerate) {
   s->driftdepth=0.1;
   s->resonance = RESONANCE;
   s->dcfollower = 1.0e-6;
+  paramramp_init(&s->attackramp, s->ampattack);
+  paramramp_init(&s->releaseramp, s->amprelease);
 }
+
+// renders the voices listed in pool.active from first to first+n, n <=
+// LANES
+__attribute__((target_clones("avx2","default")))
+static void renderlanes(struct synth* s, int first, int n, int length,
+                        float* restrict outleft, float* restrict outright,
+                        float ampattackcoeff, float ampreleasecoeff, float freqattackcoeff) {
+  struct voices* const v = &s->voices;
+  float const samplerate = s->samplerate;
+  float const drift_ingain = s->whitenoiseamp * s->noiselowpasscoeff * (1.0/32768.0/65536.0);
+  float const drift_fbgain = 1-s->noiselowpasscoeff;
+  float const driftdepth = s->driftdepth;
+  float const invsamplerate = 1.0f / samplerate;
+  float const omegascale = 2 * 3.141592f / samplerate;
+  // the oscillator's own lowpass is the same for every voice
+  float const ek = exp(-LPFREQ2 * 2 * 3.141592 / s->samplerate);
+
+  float lpstate1[LANES], lpstate2[LANES], phase1[LANES], drift1[LANES];
+  float gate[LANES], freq[LANES], cutoffbase[LANES], smoothedfreq[LANES], smoothedamp[LANES];
+  float gainL[LANES], gainR[LANES], invinc[LANES];
+  uint32_t rng_state[LANES];
+
+  for (int l=0;l<LANES;l++) {
+    int const i = s->pool.active[first + (l < n ? l : 0)];
+    lpstate1[l] = v->lpstate1[i];
+    lpstate2[l] = v->lpstate2[i];
+    phase1[l] = v->phase1[i];
+    drift1[l] = v->drift1[i];
+    gate[l] = v->gate[i]+ENV_FLOOR;
+    freq[l] = v->freq[i] * s->bend;
+    cutoffbase[l] = v->cutoff[i];
+    smoothedfreq[l] = v->smoothedfreq[i];
+    smoothedamp[l] = v->smoothedamp[i];
+    rng_state[l] = v->rng_state[i];
+    invinc[l] = samplerate / smoothedfreq[l];
+    double const pan = ((s->pool.slotkey[i]&3)+0.5)/4.0;
+    gainL[l] = l < n ? sqrt(1-pan) * 0.125 : 0;
+    gainR[l] = l < n ? sqrt(pan) * 0.125 : 0;
+  }
+
+  for (int sample=0;sample<length;sample++) {
+    float left = 0;
+    float right = 0;
+    for (int l=0;l<LANES;l++) {
+      float drift = (int32_t)rng_state[l] * drift_ingain + drift1[l] * drift_fbgain;
+      rng_state[l] = (rng_state[l] * 196314165u) + 907633515u;
+      drift1[l] = drift;
+      float sf = smoothedfreq[l];
+      sf += (freq[l] - sf) * freqattackcoeff * sf * (1.0f/440);
+      smoothedfreq[l] = sf;
+      float pinc1 = blosc_clampinc(sf * invsamplerate * (1.0f+drift*driftdepth));
+
+      // band-limited sawtooth through the lowpass
+      invinc[l] = blosc_recip(pinc1, invinc[l]);
+      phase1[l] = blosc_advance(phase1[l], pinc1);
+      float saw = 0.5f * blosc_saw(phase1[l], invinc[l]);
+      float osc = lpstate2[l] = saw + (lpstate2[l] - saw) * ek;
+
+      float octaves = lanelog2(sf*(1.0f/440));
+      float cutoff = cutoffbase[l] * laneexp2(CUTOFF_TRACKING*octaves);
+      float gain = DC_GAIN * laneexp2(-GAIN_TRACKING*octaves);
+
+      float ampdiff = gate[l] - smoothedamp[l];
+      float env = smoothedamp[l] += ampdiff * (ampdiff > 0 ? ampattackcoeff : ampreleasecoeff);
+
+      osc *= env * 4;
+      float omega = cutoff * omegascale;
+      float lpcoeff1 = omega / (omega + 1);
+      float filtered = lpstate1[l] += lanetanh(osc - lpstate1[l]) * lpcoeff1;
+      osc = filtered * gain;
+
+      left += osc * gainL[l];
+      right += osc * gainR[l];
+    }
+    outleft[sample] += left;
+    outright[sample] += right;
+  }
+
+  for (int l=0;l<n;l++) {
+    int const i = s->pool.active[first + l];
+    v->lpstate1[i] = lpstate1[l];
+    v->lpstate2[i] = lpstate2[l];
+    v->phase1[i] = phase1[l];
+    v->drift1[i] = drift1[l];
+    v->smoothedfreq[i] = smoothedfreq[l];
+    v->smoothedamp[i] = smoothedamp[l];
+    v->rng_state[i] = rng_state[l];
+  }
+}
+
 static void process(void* synth, int length, float const* const* in, float* const* out) {
   struct synth* const s = synth;
-  double const whitenoiseamp = s->whitenoiseamp;
-  double const noiselowpasscoeff = s->noiselowpasscoeff;
-  double const driftdepth = s->driftdepth;
-  double const drift_ingain = whitenoiseamp * noiselowpasscoeff * (1.0/32768.0/65536.0);
-  double const drift_fbgain = 1-noiselowpasscoeff;
-  double const bend = s->bend;
-  int rng_state = s->rng_state;
+  // envelope times only need to follow their ramps at block rate
+  s->ampattack = paramramp_advance(&s->attackramp, length);
+  s->amprelease = paramramp_advance(&s->releaseramp, length);
   double ampattackcoeff = 1.0/(s->ampattack*s->samplerate+0.0000001);
   if (ampattackcoeff > 0.5)
     ampattackcoeff = 0.5;
@@ -101,9 +201,6 @@ static void process(void* synth, int length, float const* const* in, float* cons
   double freqattackcoeff = 1.0/(s->freqattack*s->samplerate+0.0000001);
   if (freqattackcoeff > 0.5)
     freqattackcoeff = 0.5;
-  double filterattackcoeff = 1.0/(s->filterattack*s->samplerate+0.0000001);
-  if (filterattackcoeff > 0.5)
-    filterattackcoeff = 0.5;
   
   float* restrict outleft=out[0];
   float* restrict outright=out[1];
@@ -112,123 +209,59 @@ static void process(void* synth, int length, float const* const* in, float* cons
     outleft[sample]=1.0e-12;
     outright[sample]=1.0e-12;
   }
-  double const omega2 = LPFREQ2 * 2 * 3.141592 / s->samplerate;
-  //double const lpcoeff2 = omega2 / (omega2 + 1);
-
-  for(int voiceno=0;voiceno<128;voiceno++) {
-    struct voice* restrict v = &s->voice[voiceno];
-    if(v->active) {
-      double const freq = v->freq * bend;
-      double smoothedfreq = v->smoothedfreq;
-
-      double smoothedamp = v->smoothedamp;
-      double const gate = v->gate+1.0e-6;
-      
-      double const pan = ((voiceno&3)+0.5)/4.0;
-      double const gainL = sqrt(1-pan);
-      double const gainR = sqrt(pan);
-          
-      for(int sample = 0; sample<length;sample++) {
-        
-	double drift1 = v->drift1;
-	drift1 = (int)rng_state * drift_ingain + drift1 * drift_fbgain;
-	rng_state = (rng_state * 196314165u) + 907633515u;
-	v->drift1 = drift1;
-	double phase1 = v->phase1;
-	smoothedfreq += (freq - smoothedfreq) * freqattackcoeff * smoothedfreq / 440.0;
-	double phaseinc = smoothedfreq / s->samplerate; 
-	double pinc1 = phaseinc * (1.0+drift1*driftdepth);
-	
-	/*
-	phase1 += pinc1;
-	while (phase1 >= 1.0) { phase1 -= 1; }
-	double osc = phase1;
-	*/
-
-
-	/* double osc = phase1 + pinc1*0.5; */
-	/* phase1 += pinc1; */
-	/* while (phase1 >= 1.0) { osc -= (phase1-1.0) / pinc1; phase1 -= 1; } */
-        phase1 += pinc1;
-	double k = -omega2;
-	double ek = exp(k);
-	v->lpstate2 *= ek;
-	{
-	  double c_a = 1-ek;
-	  double c_b = - ek - c_a / k;
-	  double a = phase1;
-	  double b = -pinc1;
-
-	  v->lpstate2 += c_a * a + c_b * b;
-	}
-	while (phase1 >= 1.0) {
-	  double t = (phase1 - 1.0) / pinc1;
-	  v->lpstate2 -= 1 - exp(k*t);
-	  phase1 -= 1.0;
-	}
-	double osc = v->lpstate2 - 0.5;
-	//double osc = v->phase1 - 0.5;
-
-        double cutoff = v->cutoff * powf(smoothedfreq/440,CUTOFF_TRACKING);;
-	v->smoothedcutoff += (cutoff - v->smoothedcutoff) * filterattackcoeff * v->smoothedcutoff / 10000;
-
-	v->phase1=phase1;
-
-        double smoothedampdiff = (gate - smoothedamp);
-        double env = smoothedamp+=smoothedampdiff*
-          (smoothedampdiff > 0 ? ampattackcoeff : ampreleasecoeff);
-
-        double const gain = DC_GAIN * powf(smoothedfreq/440,-GAIN_TRACKING);
-
-	//double freq_above_gain = smoothedfreq/GAIN_CORNER;
-	//double gain = DC_GAIN / sqrt(1.0 + freq_above_gain * freq_above_gain);
-
-        osc *= env;
-	double omega = cutoff * 2 * 3.141592 / s->samplerate;
-	osc *= 4;
-	double lpcoeff1 = omega / (omega + 1);
-	osc = v->lpstate1 += fasttanh(osc - v->lpstate1) * lpcoeff1;
-	//osc = moogfilter_tick(&v->filter, osc, omega, s->resonance);
-	osc *= 0.125;
-	osc *= gain;
-	
-	//osc = v->lpstate1 += fasttanh(osc - v->lpstate1) * lpcoeff1;
-	//osc = v->lpstate2 += (osc - v->lpstate2) * lpcoeff2;
-
-        outleft[sample] += osc * gainL;
-        outright[sample] += osc * gainR;
-      }
-      
-      v->smoothedfreq = smoothedfreq;
-      v->smoothedamp = smoothedamp;
-      if (!v->gate && smoothedamp < 1.0e-6) {
-        v->active = 0;
-      }
-    }
+
+  for (int first=0;first<s->pool.num_active;first+=LANES) {
+    int n = s->pool.num_active - first;
+    if (n > LANES)
+      n = LANES;
+    renderlanes(s, first, n, length, outleft, outright,
+                ampattackcoeff, ampreleasecoeff, freqattackcoeff);
+  }
+
+  // give back the voices that went quiet
+  struct voices* const v = &s->voices;
+  for (int j=0;j<s->pool.num_active;) {
+    int const i = s->pool.active[j];
+    if (!v->gate[i] && v->smoothedamp[i] < 2*ENV_FLOOR)
+      voicepool_release(&s->pool, i);
+    else
+      j++;
   }
+
   for(int sample = 0; sample<length;sample++) {
     outleft[sample] -= s->dcfollower;
     outright[sample] -= s->dcfollower;
     s->dcfollower += (outleft[sample]+outright[sample])*0.5*120/s->samplerate;
   }
-    
-  s->rng_state = rng_state;
 }
 
 static void noteon(void* synth, int key, float freq, float velocity) {
   struct synth* const s = synth;
-  struct voice* const v = &s->voice[key];
-  v->freq = freq;
+  struct voices* const v = &s->voices;
+  int fresh;
+  int const i = voicepool_noteon(&s->pool, key, &fresh);
+  if (i < 0)
+    return;
+  if (fresh) {
+    // the slot may hold another key's voice
+    v->lpstate1[i] = 0;
+    v->lpstate2[i] = 0;
+    v->drift1[i] = 0;
+    v->smoothedamp[i] = 1.0e-5;
+    v->smoothedfreq[i] = s->keyfreq[key];
+  }
+  v->freq[i] = freq;
+  s->keyfreq[key] = freq;
 
-  v->gate = 1.0;
-  v->cutoff = CUTOFF * velocity * 2;
-  v->active=1;
+  v->gate[i] = 1.0;
+  v->cutoff[i] = CUTOFF * velocity * 2;
 };
 
 static void noteoff(void* synth, int key) {
   struct synth* const s = synth;
-  struct voice* const v = &s->voice[key];
-  v->gate=0.0;
+  int const i = voicepool_find(&s->pool, key);
+  if (i >= 0)
+    s->voices.gate[i]=0.0;
 };
 
 static void vol(void* synth, float vol) {
@@ -249,10 +282,36 @@ static void pitchbend(void* synth, float cents) {
 static void attack(void* synth, float seconds) {
   struct synth* s = synth;
   s->ampattack = seconds;
+  paramramp_init(&s->attackramp, seconds);
 }
 static void release(void* synth, float seconds) {
   struct synth* s = synth;
   s->amprelease = seconds;
+  paramramp_init(&s->releaseramp, seconds);
+}
+
+static float getattack(void* synth) {
+  struct synth* s = synth;
+  return s->attackramp.target;
+}
+static float getrelease(void* synth) {
+  struct synth* s = synth;
+  return s->releaseramp.target;
+}
+
+static void paramevents(void* synth, int count, struct paramevent const* events) {
+  struct synth* s = synth;
+  for(int i=0;i<count;i++) {
+    struct paramevent const* e = &events[i];
+    switch(e->param) {
+    case 0:
+      paramramp_settarget(&s->attackramp, e->offset, e->target, e->ramplength);
+      break;
+    case 1:
+      paramramp_settarget(&s->releaseramp, e->offset, e->target, e->ramplength);
+      break;
+    }
+  }
 }
 
 int cmd_values(void* actiondata, void* v, char* line) {
@@ -263,11 +322,16 @@ int cmd_values(void* actiondata, void* v, char* line) {
 }
 
 static struct paramdesc params[] = {
-  { .name="attack", .unit="s", .min=0.0, .max=10.0, .set = attack },
-  { .name="release", .unit="s", .min=0.0, .max=10.0, .set = release },
+  { .name="attack", .unit="s", .min=0.0, .max=10.0, .get = getattack, .set = attack },
+  { .name="release", .unit="s", .min=0.0, .max=10.0, .get = getrelease, .set = release },
   { }
 };
 
+static int isidle(void* synth) {
+  struct synth* const s = synth;
+  return s->pool.num_active == 0;
+}
+
 static int size(float samplerate) {
   return sizeof(struct synth);
 }
@@ -280,6 +344,8 @@ struct synthdesc synthdesc = {
   .params = params,
   .init = init,
   .process = process,
+  .paramevents = paramevents,
+  .isidle = isidle,
   .noteon = noteon,
   .noteoff = noteoff,
   .pitchbend = pitchbend,
@@ -1,5 +1,8 @@
 #include "synthdesc.h"
 #include "moogfilter2.h"
+#include "voicepool.h"
+#include "blosc.h"
+#include "lanemath.h"
 #include <strings.h> // bzero
 #include <stdlib.h>
 #include <math.h>
@@ -8,18 +11,22 @@
 
 #define OSCS 3
 
+#define POLYPHONY 32
+#define GROUP_VOICES LANES // active voices per task, rendered in parallel if the host can
+#define VOICE_GROUPS (POLYPHONY/GROUP_VOICES)
+#define GROUP_BLOCK 256 // samples per parallel pass
+
 double detune[OSCS] = { 1.0, 1.001, 0.998951, 1.00181982, 0.9981823, 1.00092381, 0.9991238 };
 
 struct voice {
   struct moogfilter2 filter;
-  double phase[OSCS];
+  double phase[OSCS]; // 0 to 1
   double drift[OSCS];
   double gate;
   double fgain;
   double phaseinc;
   double invphaseinc;
   double smoothedamp;
-  int active;
 };
 enum osctype {
   saw,
@@ -27,7 +34,8 @@ enum osctype {
 };
 
 struct synth {
-  struct voice voice[128];
+  struct voice voice[POLYPHONY]; // indexed by voicepool slot
+  struct voicepool pool;
   double driftdepth;
   double ampattack;
   double amprelease;
@@ -39,25 +47,33 @@ struct synth {
   double invbend;
   double filterscale;
   double resonance;
+  double filtertolerance;
   double dcfollower;
   int osctype;
   int vcftype;
+  struct synthhost const* host;
+
+  // shared with the voice group tasks during a pass
+  double ampattackcoeff;
+  double ampreleasecoeff;
+  int passlength;
+  float groupout[VOICE_GROUPS][2][GROUP_BLOCK];
 };
 
 static void init(void* synth, float samplerate) {
   struct synth* s = synth;
   int i,j;
-  for(i=0;i<128;i++) {
+  for(i=0;i<POLYPHONY;i++) {
     struct voice* v = &s->voice[i];
     v->gate=0;
     for(j=0;j<OSCS;j++) {
       moogfilter2_init(&v->filter);
-      v->phase[j]=-0.5+rand()*(1.0/(RAND_MAX+1.0));
+      v->phase[j]=rand()*(1.0/(RAND_MAX+1.0));
       v->drift[j]=0;
     }
     v->smoothedamp=1.0e-5;
-    v->active = 0;
   }
+  voicepool_init(&s->pool, POLYPHONY, VOICEPOOL_STEAL_OLDEST);
   s->samplerate = samplerate;
   s->ampattack = 0.003;
   s->amprelease = 0.020;
@@ -69,26 +85,172 @@ static void init(void* synth, float samplerate) {
   s->driftdepth=0.05;
   s->osctype=saw;
   s->resonance = 0.5;
+  s->filtertolerance = MOOGFILTER2_TOLERANCE;
   s->dcfollower = 1.0e-6;
+  s->host = NULL;
+}
+
+// renders the voices listed in pool.active from first to first+n, n <=
+// LANES, with the oscillator type fixed when this is inlined into one of
+// the kernels below
+static inline __attribute__((always_inline))
+void renderlanes(struct synth* const s, int const osctype, int first, int n,
+                 int length, float* restrict outleft, float* restrict outright) {
+  float const ampattackcoeff = s->ampattackcoeff;
+  float const ampreleasecoeff = s->ampreleasecoeff;
+  float const filterscale = s->filterscale;
+  float const k = s->resonance*4;
+  float const tolerance = s->filtertolerance;
+
+  float phase[OSCS][LANES], pinc[OSCS][LANES], invpinc[OSCS][LANES];
+  float smoothedamp[LANES], gate[LANES], fgain[LANES], gainL[LANES], gainR[LANES];
+  float fin[LANES], y0[LANES], y1[LANES], y2[LANES], y3[LANES];
+
+  for (int l=0;l<LANES;l++) {
+    int const slot = s->pool.active[first + (l < n ? l : 0)];
+    struct voice const* v = &s->voice[slot];
+    double const phaseinc = v->phaseinc * s->bend;
+    for (int j=0;j<OSCS;j++) {
+      phase[j][l] = v->phase[j];
+      pinc[j][l] = blosc_clampinc(phaseinc * detune[j]);
+      invpinc[j][l] = 1.0f / pinc[j][l];
+    }
+    smoothedamp[l] = v->smoothedamp;
+    gate[l] = v->gate+1.0e-6;
+    fgain[l] = v->fgain;
+    fin[l] = v->filter.in;
+    y0[l] = v->filter.y0;
+    y1[l] = v->filter.y1;
+    y2[l] = v->filter.y2;
+    y3[l] = v->filter.y3;
+
+    double const gain = pow(440.0/(s->samplerate*phaseinc*s->bend),0.2) * sqrt(0.01/OSCS);
+    double const pan = (0.5+(s->pool.slotkey[slot]&3))*(1.0/4.0);
+    double const makeupGain = 1.0/sqrt((1-pan)*(1-pan)+pan*pan);
+    gainL[l] = l < n ? 4 * gain * (1-pan) * makeupGain : 0;
+    gainR[l] = l < n ? 4 * gain * pan * makeupGain : 0;
+  }
+
+  for (int sample=0;sample<length;sample++) {
+    float env[LANES], b[LANES], ib[LANES], ZperX[LANES], Zconst[LANES], X[LANES], IN[LANES];
+
+    for (int l=0;l<LANES;l++) {
+      float oscs = 1.0e-5f;
+      for (int j=0;j<OSCS;j++) {
+        float const p = phase[j][l] = blosc_advance(phase[j][l], pinc[j][l]);
+        if (osctype == saw)
+          oscs += blosc_saw(p, invpinc[j][l]);
+        else
+          oscs += blosc_parabola(p, pinc[j][l], invpinc[j][l]);
+      }
+      IN[l] = oscs;
+
+      float ampdiff = gate[l] - smoothedamp[l];
+      env[l] = smoothedamp[l] += ampdiff * (ampdiff > 0 ? ampattackcoeff : ampreleasecoeff);
+
+      float omega = filterscale * fgain[l];
+      fgain[l] -= fgain[l] * fgain[l] * 0.02f;
+      omega = omega > 1.999f ? 1.999f : omega < 0 ? 0 : omega;
+
+      // the same implicit step as moogfilter2_tick
+      float bl = omega*0.5f;
+      float ibl = 1-omega;
+      b[l] = bl;
+      ib[l] = ibl;
+      float Y0const = ibl*y0[l];
+      float Y1const = bl*Y0const+ibl*y1[l];
+      float Y2const = bl*Y1const+ibl*y2[l];
+      float Y3const = bl*Y2const+ibl*y3[l];
+      ZperX[l] = -k*bl*bl*bl*bl;
+      Zconst[l] = 0.5f*(fin[l]+oscs - k*(y3[l]+Y3const));
+      X[l] = Zconst[l] / (1-ZperX[l]);
+    }
+
+    // newton-raphson until every lane has converged
+    for (int i=0;i<MOOGFILTER2_MAX_ITERATIONS;i++) {
+      float maxstep = 0;
+      for (int l=0;l<LANES;l++) {
+        float dX = moogfilter2_newton_step(Zconst[l], ZperX[l], X[l]);
+        X[l] -= dX;
+        float a = fabsf(dX);
+        maxstep = a > maxstep ? a : maxstep;
+      }
+      if (maxstep < tolerance)
+        break;
+    }
+
+    float left = 0;
+    float right = 0;
+    for (int l=0;l<LANES;l++) {
+      float Y0 = b[l]*X[l]        + ib[l]*y0[l];
+      float Y1 = b[l]*(y0[l]+Y0) + ib[l]*y1[l];
+      float Y2 = b[l]*(y1[l]+Y1) + ib[l]*y2[l];
+      float Y3 = b[l]*(y2[l]+Y2) + ib[l]*y3[l];
+      y0[l] = Y0;
+      y1[l] = Y1;
+      y2[l] = Y2;
+      y3[l] = Y3;
+      fin[l] = IN[l];
+      float out = Y3 * env[l];
+      left += out * gainL[l];
+      right += out * gainR[l];
+    }
+    outleft[sample] += left;
+    outright[sample] += right;
+  }
+
+  for (int l=0;l<n;l++) {
+    struct voice* v = &s->voice[s->pool.active[first + l]];
+    for (int j=0;j<OSCS;j++)
+      v->phase[j] = phase[j][l];
+    v->smoothedamp = smoothedamp[l];
+    v->fgain = fgain[l];
+    v->filter.in = fin[l];
+    v->filter.y0 = y0[l];
+    v->filter.y1 = y1[l];
+    v->filter.y2 = y2[l];
+    v->filter.y3 = y3[l];
+  }
+}
+
+// one kernel per oscillator type
+__attribute__((target_clones("avx2","default")))
+static void renderlanes_saw(struct synth* const s, int first, int n,
+                            int length, float* outleft, float* outright) {
+  renderlanes(s, saw, first, n, length, outleft, outright);
+}
+__attribute__((target_clones("avx2","default")))
+static void renderlanes_thorn(struct synth* const s, int first, int n,
+                              int length, float* outleft, float* outright) {
+  renderlanes(s, thorn, first, n, length, outleft, outright);
+}
+
+// one task of the parallel pass: the group'th set of GROUP_VOICES active
+// voices, summed into that group's buffer
+static void rendergroup(void* synth, int group) {
+  struct synth* const s = synth;
+  float* outleft = s->groupout[group][0];
+  float* outright = s->groupout[group][1];
+  for(int sample = 0; sample<s->passlength;sample++) {
+    outleft[sample]=0;
+    outright[sample]=0;
+  }
+  int const first = group*GROUP_VOICES;
+  int const n = s->pool.num_active-first < GROUP_VOICES ? s->pool.num_active-first : GROUP_VOICES;
+  if (s->osctype == thorn)
+    renderlanes_thorn(s, first, n, s->passlength, outleft, outright);
+  else
+    renderlanes_saw(s, first, n, s->passlength, outleft, outright);
 }
 
 static void process(void* synth, int length, float const* const* in, float* const* out) {
   struct synth* const s = synth;
-  double const whitenoiseamp = s->whitenoiseamp;
-  double const noiselowpasscoeff = s->noiselowpasscoeff;
-  double const driftdepth = s->driftdepth;
-  double const drift_ingain = whitenoiseamp * noiselowpasscoeff * (1.0/32768.0/65536.0);
-  double const drift_fbgain = 1-noiselowpasscoeff;
-  double const bend = s->bend;
-  double const invbend = s->invbend;
-  int rng_state = s->rng_state;
-  double ampattackcoeff = 1.0/(s->ampattack*s->samplerate+0.0000001);
-  if (ampattackcoeff > 0.5)
-    ampattackcoeff = 0.5;
-  double ampreleasecoeff = 1.0/(s->amprelease*s->samplerate+0.0000001);
-  if (ampreleasecoeff > 0.5)
-    ampreleasecoeff = 0.5;
-  int const osctype = s->osctype;
+  s->ampattackcoeff = 1.0/(s->ampattack*s->samplerate+0.0000001);
+  if (s->ampattackcoeff > 0.5)
+    s->ampattackcoeff = 0.5;
+  s->ampreleasecoeff = 1.0/(s->amprelease*s->samplerate+0.0000001);
+  if (s->ampreleasecoeff > 0.5)
+    s->ampreleasecoeff = 0.5;
   
   float* restrict outleft=out[0];
   float* restrict outright=out[1];
@@ -98,101 +260,58 @@ static void process(void* synth, int length, float const* const* in, float* cons
     outright[sample]=1.0e-12;
   }
 
-  for(int voiceno=0;voiceno<128;voiceno++) {
-    struct voice* restrict v = &s->voice[voiceno];
-    if(v->active) {
-      double const phaseinc = v->phaseinc * bend;
-
-      //double const sqrtinvphaseinc = sqrt(v->invphaseinc * invbend);
-      //double const gain = 1;
-      double gain = pow(440.0/(s->samplerate*phaseinc*bend),0.2);
-      //double const gain = sqrt(440.0/(s->samplerate*phaseinc*bend));
-      //double const gain = (440.0/(s->samplerate*phaseinc*bend));
-
-      double smoothedamp = v->smoothedamp;
-      double gate = v->gate+1.0e-6;
-      
-      for(int sample = 0; sample<length;sample++) {
-        double oscs = 1.0e-5;
-
-        for(int j=0;j<OSCS;j++) {
-	  /*
-          double drift = v->drift[j];
-          drift = (int)rng_state * drift_ingain + drift * drift_fbgain;
-          rng_state = (rng_state * 196314165u) + 907633515u;
-          v->drift[j] = drift;
-	  */
-          double phase = v->phase[j];
-          double pinc = phaseinc /* * (1.0+drift*driftdepth)*/ * detune[j];
-
-          double osc;
-
-          switch(osctype) {
-          default:
-          case saw:
-	    { double v1 = phase*phase;
-	      phase += pinc;
-	      while (phase >= 0.5) {
-		phase -= 1;
-	      }
-	      double v2 = phase*phase;
-	      osc = (v2-v1) / pinc;
-	    }
-            break;
-          case thorn:
-            phase += pinc;
-            while (phase >= 0.5) {
-              phase -= 1;
-            }
-            osc = phase*phase*4-0.3333333333;
-
-            break;
-          }
-
-          v->phase[j]=phase;
-          oscs += osc;
-        }
-        double smoothedampdiff = (gate-smoothedamp);
-        double env = smoothedamp+=smoothedampdiff*
-          (smoothedampdiff > 0 ? ampattackcoeff : ampreleasecoeff);
-
-        double omega = s->filterscale * v->fgain;
-	v->fgain -= v->fgain * v->fgain * 0.02;
-        double resonance = s->resonance;
-	
-	oscs = 4*moogfilter2_tick(&v->filter, oscs, omega, resonance);
-
-        env *= gain * sqrt(0.01/OSCS);
-        oscs *= env;
-	double pan = (0.5+(voiceno&3))*(1.0/4.0);
-	double gainL = (1-pan);
-	double gainR = (pan);
-	double makeupGain = 1.0/sqrt(gainL*gainL+gainR*gainR);
-	gainL *= makeupGain;
-	gainR *= makeupGain;
-
-        outleft[sample] += oscs * gainL;
-        outright[sample] += oscs * gainR;
-      }
-      
-      v->smoothedamp = smoothedamp;
-      if (!v->gate && smoothedamp < 1.0e-4) {
-        v->active = 0;
+  for(int offset = 0; offset<length; offset+=GROUP_BLOCK) {
+    int const n = length-offset < GROUP_BLOCK ? length-offset : GROUP_BLOCK;
+    int const numgroups = (s->pool.num_active+GROUP_VOICES-1)/GROUP_VOICES;
+    s->passlength = n;
+    if (s->host)
+      s->host->parallel_for(s->host, numgroups, rendergroup, s);
+    else
+      for(int i=0;i<numgroups;i++)
+        rendergroup(s, i);
+    // sum in a fixed order, so the result doesn't depend on the threads
+    for(int group=0;group<numgroups;group++) {
+      for(int sample = 0; sample<n;sample++) {
+        outleft[offset+sample] += s->groupout[group][0][sample];
+        outright[offset+sample] += s->groupout[group][1][sample];
       }
     }
   }
+  // give back the voices that went quiet
+  for (int j=0;j<s->pool.num_active;) {
+    int const i = s->pool.active[j];
+    if (!s->voice[i].gate && s->voice[i].smoothedamp < 1.0e-4)
+      voicepool_release(&s->pool, i);
+    else
+      j++;
+  }
+
   for(int sample = 0; sample<length;sample++) {
     outleft[sample] -= s->dcfollower;
     outright[sample] -= s->dcfollower;
     s->dcfollower += ((outleft[sample]+outright[sample])*0.5 - s->dcfollower)*0.5*20/s->samplerate;
   }
-    
-  s->rng_state = rng_state;
+}
+
+static void sethost(void* synth, struct synthhost const* host) {
+  struct synth* const s = synth;
+  s->host = host;
 }
 
 static void noteon(void* synth, int key, float freq, float velocity) {
   struct synth* const s = synth;
-  struct voice* const v = &s->voice[key];
+  int fresh;
+  int const slot = voicepool_noteon(&s->pool, key, &fresh);
+  if (slot < 0)
+    return;
+  struct voice* const v = &s->voice[slot];
+  if (fresh) {
+    // the slot may hold another key's voice
+    moogfilter2_init(&v->filter);
+    for (int j=0;j<OSCS;j++)
+      v->drift[j] = 0;
+    v->smoothedamp = 1.0e-5;
+  }
   v->phaseinc = freq/s->samplerate;
   v->invphaseinc = 440.0/44100.0/v->phaseinc;
 
@@ -200,13 +319,13 @@ static void noteon(void* synth, int key, float freq, float velocity) {
   v->gate = 1.0;
   float base = 440 * pow(freq / 440, 0.5);
   v->fgain=base*velocity / s->samplerate;
-  v->active=1;
 };
 
 static void noteoff(void* synth, int key) {
   struct synth* const s = synth;
-  struct voice* const v = &s->voice[key];
-  v->gate=0;
+  int const slot = voicepool_find(&s->pool, key);
+  if (slot >= 0)
+    s->voice[slot].gate=0;
 };
 
 static void vol(void* synth, float vol) {
@@ -234,6 +353,15 @@ static void release(void* synth, float seconds) {
   s->amprelease = seconds;
 }
 
+static float getattack(void* synth) {
+  struct synth* s = synth;
+  return s->ampattack;
+}
+static float getrelease(void* synth) {
+  struct synth* s = synth;
+  return s->amprelease;
+}
+
 int cmd_values(void* actiondata, void* v, char* line) {
   struct synth* s = v;
   printf("attack: %lf (s)\n",s->ampattack);
@@ -242,11 +370,16 @@ int cmd_values(void* actiondata, void* v, char* line) {
 }
 
 static struct paramdesc params[] = {
-  { .name="attack", .unit="s", .min=0.0, .max=10.0, .set = attack },
-  { .name="release", .unit="s", .min=0.0, .max=10.0, .set = release },
+  { .name="attack", .unit="s", .min=0.0, .max=10.0, .get = getattack, .set = attack },
+  { .name="release", .unit="s", .min=0.0, .max=10.0, .get = getrelease, .set = release },
   { }
 };
 
+static int isidle(void* synth) {
+  struct synth* const s = synth;
+  return s->pool.num_active == 0;
+}
+
 static int size(float samplerate) {
   return sizeof(struct synth);
 }
@@ -258,7 +391,9 @@ struct synthdesc synthdesc = {
   .size = size,
   .params = params,
   .init = init,
+  .sethost = sethost,
   .process = process,
+  .isidle = isidle,
   .noteon = noteon,
   .noteoff = noteoff,
   .pitchbend = pitchbend,
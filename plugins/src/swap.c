@@ -13,9 +13,15 @@ static void process(void* state, int length, float const* const* in, float*const
   }
 }
 
+static float tail(void* self) {
+  return 0;
+}
+
 struct synthdesc synthdesc = {
   .name = "swap",
   .numinputs = 2,
   .numoutputs = 2,
-  .process = process
+  .process = process,
+  .tail = tail,
+  .flags = SYNTHDESC_INPLACE,
 };
@@ -1,20 +1,64 @@
 #ifndef SYNTHDESC_H_INCLUDED
 #define SYNTHDESC_H_INCLUDED
 
+#define SYNTHDESC_ALIGNMENT 64
+
+// flags
+#define SYNTHDESC_INPLACE 1 // process works with in and out being the same buffers
+
+struct paramevent {
+  int offset; // sample in the next block where the ramp starts
+  int param; // index into params
+  float target;
+  int ramplength; // samples to reach target, 0 to jump
+};
+
+// services the host offers to plugins, see sethost
+struct synthhost {
+  // calls fn(arg, i) for every i from 0 to count-1, possibly on several
+  // threads at once, and returns when all calls have returned
+  void (*parallel_for)(struct synthhost const* host, int count, void (*fn)(void* arg, int index), void* arg);
+};
+
 struct synthdesc {
   const char* name;
   int numinputs;
   int numoutputs;
-  int (*size)(float samplerate); // amount of memory to allocate for init's first argument
+  // amount of memory to allocate for init's first argument. it should
+  // cover everything the plugin needs, buffers included (see
+  // shared/arena.h), so that init doesn't allocate. the host hands it over
+  // aligned to SYNTHDESC_ALIGNMENT and prefaulted.
+  int (*size)(float samplerate);
   void (*init)(void* synth, float samplerate);
   void (*finalize)(void* synth); // does not free the memory for the synth
+  // optional. called right after init. host stays valid until finalize.
+  void (*sethost)(void* synth, struct synthhost const* host);
   void (*process)(void* synth, int length, float const*const* in, float*const* out);
+  // optional. like process, but adds to what is already in out instead of
+  // overwriting it, so several plugins can be summed into one buffer
+  void (*processadding)(void* synth, int length, float const*const* in, float*const* out);
+  int flags;
+  // optional. parameter changes for the next call to process, sorted by
+  // offset. the plugin ramps each parameter to its target on its own, at
+  // audio or control rate.
+  void (*paramevents)(void* synth, int count, struct paramevent const* events);
   void (*noteon)(void* synth, int voice, float freq, float velocity);
   void (*noteoff)(void* synth, int voice);
   void (*pitchbend)(void* synth, float cents);
   void (*mod)(void* synth, float value);
   void (*vol)(void* synth, float value);
   struct paramdesc* params; // terminated by first param with NULL name
+  // optional. nonzero if nothing is sounding, so that process would only
+  // output silence given silent input. the host may then skip process.
+  int (*isidle)(void* synth);
+  // optional. seconds the output keeps sounding after the input goes
+  // silent. once that long has passed with silent input the host may skip
+  // process. without it the host never skips an effect.
+  float (*tail)(void* synth);
+  // optional. samples by which the output lags behind the input and note
+  // events, e.g. from lookahead or linear phase filters. the host
+  // compensates for it. without it the latency is taken to be zero.
+  int (*latency)(void* synth);
 };
 
 struct paramdesc {
@@ -0,0 +1,301 @@
+#include "synthdesc.h"
+#include "shared/paramramp.h"
+#include "shared/voicepool.h"
+#include "shared/wavetable.h"
+#include "shared/lanemath.h"
+#include <math.h>
+#include <stdint.h>
+
+#define POLYPHONY 64 // room for large chords, the voices are cheap
+#define PHASE_FRACBITS (32-WAVETABLE_BITS) // bits of the phase below the table index
+
+enum {
+  PARAM_SHAPE,
+  PARAM_ATTACK,
+  PARAM_RELEASE,
+  NUM_PARAMS
+};
+
+// voice state kept one array per field, indexed by voicepool slot
+struct voices {
+  uint32_t phase[POLYPHONY]; // a whole cycle is 2^32
+  float freq[POLYPHONY];
+  float gate[POLYPHONY];
+  float velocity[POLYPHONY];
+  float amp[POLYPHONY];
+};
+
+struct synth {
+  struct voices voices;
+  struct voicepool pool;
+  float const* tables[WAVETABLE_SHAPES]; // from the shared cache
+  double samplerate;
+  double bend;
+  double mod;
+  double dcfollower;
+  struct paramramp ramp[NUM_PARAMS];
+};
+
+static void init(void* synth, float samplerate) {
+  struct synth* const s = synth;
+  struct voices* const v = &s->voices;
+  for (int i=0;i<POLYPHONY;i++) {
+    v->phase[i] = 0;
+    v->freq[i] = 440;
+    v->gate[i] = 0;
+    v->velocity[i] = 0;
+    v->amp[i] = 0;
+  }
+  voicepool_init(&s->pool, POLYPHONY, VOICEPOOL_STEAL_OLDEST);
+  // the first instance builds the tables, the others find them ready
+  for (int shape=0;shape<WAVETABLE_SHAPES;shape++)
+    s->tables[shape] = wavetable_get(shape);
+  s->samplerate = samplerate;
+  s->bend = 1.0;
+  s->mod = 0;
+  s->dcfollower = 1.0e-6;
+  paramramp_init(&s->ramp[PARAM_SHAPE], WAVETABLE_SAW);
+  paramramp_init(&s->ramp[PARAM_ATTACK], 0.005);
+  paramramp_init(&s->ramp[PARAM_RELEASE], 0.100);
+}
+
+// renders the voices listed in pool.active from first to first+n, n <=
+// LANES, reading table a and b mixed by morph. with AVX2 the table reads
+// become gathers.
+__attribute__((target_clones("avx2","default")))
+static void renderlanes(struct synth* s, int first, int n, int length,
+                        float* restrict outleft, float* restrict outright,
+                        float const* restrict a, float const* restrict b, float morph,
+                        float attackcoeff, float releasecoeff) {
+  struct voices* const v = &s->voices;
+  uint32_t phase[LANES], inc[LANES];
+  int32_t offset[LANES];
+  float gate[LANES], amp[LANES], gainL[LANES], gainR[LANES];
+
+  for (int l=0;l<LANES;l++) {
+    int const i = s->pool.active[first + (l < n ? l : 0)];
+    double const cycles = v->freq[i] * s->bend / s->samplerate;
+    phase[l] = v->phase[i];
+    inc[l] = (uint32_t)(cycles * 4294967296.0);
+    offset[l] = wavetable_level(cycles) * WAVETABLE_STRIDE;
+    gate[l] = v->gate[i];
+    amp[l] = v->amp[i];
+    double const pan = ((s->pool.slotkey[i]&3)+0.5)/4.0;
+    gainL[l] = l < n ? sqrt(1-pan) * 0.125 * v->velocity[i] : 0;
+    gainR[l] = l < n ? sqrt(pan) * 0.125 * v->velocity[i] : 0;
+  }
+
+  for (int sample=0;sample<length;sample++) {
+    float left = 0;
+    float right = 0;
+    for (int l=0;l<LANES;l++) {
+      int32_t const index = offset[l] + (int32_t)(phase[l] >> PHASE_FRACBITS);
+      float const frac = (int32_t)(phase[l] & ((1u << PHASE_FRACBITS) - 1)) * (1.0f / (1u << PHASE_FRACBITS));
+      phase[l] += inc[l];
+      float const x0 = a[index] + (b[index] - a[index]) * morph;
+      float const x1 = a[index+1] + (b[index+1] - a[index+1]) * morph;
+      float osc = x0 + (x1 - x0) * frac;
+
+      float const ampdiff = gate[l] - amp[l];
+      amp[l] += ampdiff * (ampdiff > 0 ? attackcoeff : releasecoeff);
+      osc *= amp[l];
+      left += osc * gainL[l];
+      right += osc * gainR[l];
+    }
+    outleft[sample] += left;
+    outright[sample] += right;
+  }
+
+  for (int l=0;l<n;l++) {
+    int const i = s->pool.active[first + l];
+    v->phase[i] = phase[l];
+    v->amp[i] = amp[l];
+  }
+}
+
+// one pole coefficient for an envelope taking about the given time
+static float envcoeff(double seconds, double samplerate) {
+  double coeff = 1.0/(seconds*samplerate+0.0000001);
+  return coeff > 0.5 ? 0.5 : coeff;
+}
+
+#define RENDER_BLOCK 256 // samples rendered at a time
+
+// adds length <= RENDER_BLOCK samples of the voices to outleft and outright
+static void renderblock(struct synth* s, int length, float* restrict outleft, float* restrict outright) {
+  // the parameters only need to follow their ramps at block rate
+  double const shape = paramramp_advance(&s->ramp[PARAM_SHAPE], length);
+  float const attackcoeff = envcoeff(paramramp_advance(&s->ramp[PARAM_ATTACK], length), s->samplerate);
+  float const releasecoeff = envcoeff(paramramp_advance(&s->ramp[PARAM_RELEASE], length), s->samplerate);
+
+  // mod sweeps on from the shape parameter through the shapes
+  double position = shape + s->mod * (WAVETABLE_SHAPES-1);
+  if (position < 0)
+    position = 0;
+  if (position > WAVETABLE_SHAPES-1)
+    position = WAVETABLE_SHAPES-1;
+  int const lower = position < WAVETABLE_SHAPES-1 ? (int)position : WAVETABLE_SHAPES-2;
+  float const morph = position - lower;
+
+  // the voices are summed apart from what is in the outputs already, so
+  // that the dc follower works on them alone
+  float voicesout[2][RENDER_BLOCK];
+  for (int sample=0;sample<length;sample++) {
+    voicesout[0][sample] = 1.0e-12;
+    voicesout[1][sample] = 1.0e-12;
+  }
+
+  for (int first=0;first<s->pool.num_active;first+=LANES) {
+    int n = s->pool.num_active - first;
+    if (n > LANES)
+      n = LANES;
+    renderlanes(s, first, n, length, voicesout[0], voicesout[1],
+                s->tables[lower], s->tables[lower+1], morph,
+                attackcoeff, releasecoeff);
+  }
+
+  // give back the voices that went quiet
+  struct voices* const v = &s->voices;
+  for (int j=0;j<s->pool.num_active;) {
+    int const i = s->pool.active[j];
+    if (!v->gate[i] && v->amp[i] < 1.0e-6)
+      voicepool_release(&s->pool, i);
+    else
+      j++;
+  }
+
+  for (int sample=0;sample<length;sample++) {
+    float const left = voicesout[0][sample] - s->dcfollower;
+    float const right = voicesout[1][sample] - s->dcfollower;
+    s->dcfollower += (left+right)*0.5*120/s->samplerate;
+    outleft[sample] += left;
+    outright[sample] += right;
+  }
+}
+
+static void render(struct synth* s, int length, float* const* out, int adding) {
+  if (!adding) {
+    for (int sample=0;sample<length;sample++) {
+      out[0][sample] = 0;
+      out[1][sample] = 0;
+    }
+  }
+  for (int offset=0;offset<length;offset+=RENDER_BLOCK) {
+    int const n = length-offset < RENDER_BLOCK ? length-offset : RENDER_BLOCK;
+    renderblock(s, n, out[0]+offset, out[1]+offset);
+  }
+}
+
+static void process(void* synth, int length, float const* const* in, float* const* out) {
+  render(synth, length, out, 0);
+}
+
+static void processadding(void* synth, int length, float const* const* in, float* const* out) {
+  render(synth, length, out, 1);
+}
+
+static void noteon(void* synth, int key, float freq, float velocity) {
+  struct synth* const s = synth;
+  struct voices* const v = &s->voices;
+  int fresh;
+  int const i = voicepool_noteon(&s->pool, key, &fresh);
+  if (i < 0)
+    return;
+  if (fresh) {
+    v->phase[i] = 0;
+    v->amp[i] = 0;
+  }
+  v->freq[i] = freq;
+  v->velocity[i] = velocity;
+  v->gate[i] = 1.0;
+}
+
+static void noteoff(void* synth, int key) {
+  struct synth* const s = synth;
+  int const i = voicepool_find(&s->pool, key);
+  if (i >= 0)
+    s->voices.gate[i] = 0.0;
+}
+
+static void mod(void* synth, float mod) {
+  struct synth* const s = synth;
+  s->mod = mod;
+}
+
+static void pitchbend(void* synth, float cents) {
+  struct synth* const s = synth;
+  s->bend = pow(2.0,cents/1200.0);
+}
+
+static void setparam(struct synth* s, int param, float value) {
+  paramramp_init(&s->ramp[param], value);
+}
+
+// the value the parameter is heading for
+static float getparam(struct synth* s, int param) {
+  return s->ramp[param].target;
+}
+
+static float getshape(void* synth) {
+  return getparam(synth, PARAM_SHAPE);
+}
+static float getattack(void* synth) {
+  return getparam(synth, PARAM_ATTACK);
+}
+static float getrelease(void* synth) {
+  return getparam(synth, PARAM_RELEASE);
+}
+
+static void shape(void* synth, float value) {
+  setparam(synth, PARAM_SHAPE, value);
+}
+static void attack(void* synth, float seconds) {
+  setparam(synth, PARAM_ATTACK, seconds);
+}
+static void release(void* synth, float seconds) {
+  setparam(synth, PARAM_RELEASE, seconds);
+}
+
+static void paramevents(void* synth, int count, struct paramevent const* events) {
+  struct synth* const s = synth;
+  for (int i=0;i<count;i++) {
+    struct paramevent const* e = &events[i];
+    if (e->param >= 0 && e->param < NUM_PARAMS)
+      paramramp_settarget(&s->ramp[e->param], e->offset, e->target, e->ramplength);
+  }
+}
+
+// in the order of the PARAM_ enum. shape goes sine, triangle, saw,
+// square, pulse, morphing between neighbours.
+static struct paramdesc params[] = {
+  [PARAM_SHAPE] = { .name = "shape", .min = 0, .max = WAVETABLE_SHAPES-1, .get = getshape, .set = shape },
+  [PARAM_ATTACK] = { .name = "attack", .unit = "s", .min = 0.0, .max = 10.0, .get = getattack, .set = attack },
+  [PARAM_RELEASE] = { .name = "release", .unit = "s", .min = 0.0, .max = 10.0, .get = getrelease, .set = release },
+  [NUM_PARAMS] = { }
+};
+
+static int isidle(void* synth) {
+  struct synth* const s = synth;
+  return s->pool.num_active == 0;
+}
+
+static int size(float samplerate) {
+  return sizeof(struct synth);
+}
+
+struct synthdesc synthdesc = {
+  .name = "wavetable",
+  .numinputs = 0,
+  .numoutputs = 2,
+  .size = size,
+  .params = params,
+  .init = init,
+  .process = process,
+  .processadding = processadding,
+  .paramevents = paramevents,
+  .isidle = isidle,
+  .noteon = noteon,
+  .noteoff = noteoff,
+  .pitchbend = pitchbend,
+  .mod = mod,
+};
@@ -0,0 +1,50 @@
+// times moogfilter2_tick on a saw through a sweeping filter, for a few
+// newton tolerances, and prints how far each strays from a solve that
+// always takes every iteration.
+//
+// usage: filterbench [samples]
+#include "moogfilter2.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static double now_ms() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec*1e3 + t.tv_nsec/1e6;
+}
+
+static double input(int i) {
+  double phase = i*0.0037;
+  return (phase - floor(phase) - 0.5)*3;
+}
+
+static double omega(int i) {
+  return 0.3 + 0.25*sin(i*1e-4);
+}
+
+int main(int argc, char** argv) {
+  int samples = argc > 1 ? atoi(argv[1]) : 10000000;
+  double const tolerances[] = { 0, 1.0e-7, MOOGFILTER2_TOLERANCE, 1.0e-3 };
+  int const num_tolerances = sizeof(tolerances)/sizeof(tolerances[0]);
+
+  float* reference = malloc(samples*sizeof(float));
+  for (int t=0;t<num_tolerances;t++) {
+    struct moogfilter2 filter;
+    moogfilter2_init(&filter);
+    double maxdiff = 0;
+    double start = now_ms();
+    for (int i=0;i<samples;i++) {
+      float y = moogfilter2_tick(&filter, input(i), omega(i), 0.9, tolerances[t]);
+      if (t == 0)
+        reference[i] = y;
+      else if (fabs(y - reference[i]) > maxdiff)
+        maxdiff = fabs(y - reference[i]);
+    }
+    double elapsed = now_ms() - start;
+    printf("tolerance %-8g %8.1f ms, max diff %g\n", tolerances[t], elapsed, maxdiff);
+  }
+  free(reference);
+  return 0;
+}
@@ -0,0 +1,73 @@
+// renders notes through a synth plugin and prints the time taken and a
+// checksum of the output. run it on builds of the same plugin from two
+// commits to compare their speed; equal checksums mean equal output.
+//
+// usage: plugbench <path to .so> [voices] [blocks]
+#include "synthdesc.h"
+#include <dlfcn.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define SAMPLERATE 48000
+#define BLOCK 256
+
+static double now_ms() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec*1e3 + t.tv_nsec/1e6;
+}
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s <path to .so> [voices] [blocks]\n", argv[0]);
+    return 1;
+  }
+  int voices = argc > 2 ? atoi(argv[2]) : 16;
+  int blocks = argc > 3 ? atoi(argv[3]) : 2000;
+
+  // a name without a slash would be looked up in the library path
+  void* handle = dlopen(argv[1], RTLD_NOW);
+  if (!handle) {
+    fprintf(stderr, "%s\n", dlerror());
+    return 1;
+  }
+  struct synthdesc* desc = dlsym(handle, "synthdesc");
+  if (!desc) {
+    fprintf(stderr, "%s has no synthdesc\n", argv[1]);
+    return 1;
+  }
+
+  // the plugins align their vector state to the instance
+  void* synth;
+  if (posix_memalign(&synth, 64, desc->size(SAMPLERATE))) {
+    fprintf(stderr, "out of memory\n");
+    return 1;
+  }
+  srand(1);
+  desc->init(synth, SAMPLERATE);
+  for (int k=0;k<voices;k++)
+    desc->noteon(synth, k, 55*pow(2, k/12.0), 0.8);
+
+  static float left[BLOCK], right[BLOCK];
+  float* out[] = { left, right };
+  double sum = 0;
+  double start = now_ms();
+  for (int b=0;b<blocks;b++) {
+    // release half the notes halfway, so voices also finish and go idle
+    if (b == blocks/2)
+      for (int k=0;k<voices;k+=2)
+        desc->noteoff(synth, k);
+    desc->process(synth, BLOCK, NULL, out);
+    for (int i=0;i<BLOCK;i++)
+      sum += fabs(left[i]) + fabs(right[i]);
+  }
+  double elapsed = now_ms() - start;
+
+  printf("%s, %d voices, %d blocks: %.1f ms, checksum %.6g\n",
+         argv[1], voices, blocks, elapsed, sum);
+  free(synth);
+  dlclose(handle);
+  return 0;
+}